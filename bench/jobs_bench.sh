@@ -0,0 +1,36 @@
+#!/bin/sh
+# PostGen Parallel Generation Benchmark
+#
+# Generates each benchmark workload with an increasing number of jobs, timing
+# each run against a single job, and checks that the output is identical.
+#
+# Usage: jobs_bench.sh [size]
+
+BIN=$(cd "$(dirname "$0")/../bin" && pwd)
+SIZE=${1:-50000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# Gets the time in milliseconds
+now() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+cd "$DIR" || exit 1
+printf "%-8s %5s %10s %8s %10s\n" workload jobs time speedup identical
+for kind in trace shapes curves mixed; do
+    "$BIN/workload" $kind "$SIZE" > $kind.pscript || exit 1
+    for jobs in 1 2 4 8; do
+        start=$(now)
+        "$BIN/postgen" --jobs $jobs $kind.pscript > /dev/null || exit 1
+        time=$(($(now) - start))
+        if [ $jobs -eq 1 ]; then
+            serial=$time
+            mv $kind.ps serial.ps
+        fi
+        identical=yes
+        [ $jobs -eq 1 ] || cmp -s $kind.ps serial.ps || identical=no
+        awk -v k=$kind -v j=$jobs -v t=$time -v s=$serial -v i=$identical \
+            'BEGIN { printf "%-8s %5d %8dms %7.2fx %10s\n", k, j, t, s / (t ? t : 1), i }'
+    done
+done
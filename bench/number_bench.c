@@ -0,0 +1,102 @@
+/* PostGen Number Benchmark
+ *
+ * Compares parseNumber against strtod on a set of coordinate-like strings,
+ * and checks that both agree on the parsed values.
+ *
+ * Usage: number_bench [count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/number.h"
+
+// The default number of strings to parse
+#define DEFAULT_COUNT 1000000
+
+// The number of times each set of strings is parsed
+#define ROUNDS 10
+
+/*
+ * Gets the current time in seconds.
+ */
+static double now( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main( int argc, char* argv[] ) {
+    int count = DEFAULT_COUNT;
+    if( argc > 1 ) {
+        count = atoi(argv[1]);
+    }
+
+    // Generate a mix of the forms seen in scripts and generated output
+    char** strings = (char**)malloc(count * sizeof(char*));
+    srand(42);
+    for( int i = 0; i < count; i++ ) {
+        char buf[64];
+        switch( i % 4 ) {
+            case 0:
+                snprintf( buf, sizeof(buf), "%d", rand() % 2000 - 1000 );
+                break;
+            case 1:
+                snprintf( buf, sizeof(buf), "%.6f", (rand() % 2000000) / 1000.0 );
+                break;
+            case 2:
+                snprintf( buf, sizeof(buf), "%.2f", -(rand() % 100000) / 100.0 );
+                break;
+            default:
+                snprintf( buf, sizeof(buf), "%.3e", (rand() % 100000) / 7.0 );
+                break;
+        }
+        strings[i] = strdup(buf);
+    }
+
+    // Check that both parsers agree
+    int mismatches = 0;
+    for( int i = 0; i < count; i++ ) {
+        double ours;
+        double theirs = strtod( strings[i], NULL );
+        if( !parseNumber( strings[i], &ours ) || ours != theirs ) {
+            mismatches++;
+        }
+    }
+
+    // Time both parsers
+    volatile double sink = 0;
+    double start = now();
+    for( int round = 0; round < ROUNDS; round++ ) {
+        for( int i = 0; i < count; i++ ) {
+            double value;
+            parseNumber( strings[i], &value );
+            sink += value;
+        }
+    }
+    double oursTime = now() - start;
+
+    start = now();
+    for( int round = 0; round < ROUNDS; round++ ) {
+        for( int i = 0; i < count; i++ ) {
+            sink += strtod( strings[i], NULL );
+        }
+    }
+    double strtodTime = now() - start;
+
+    double total = (double)count * ROUNDS;
+    printf( "parsed %d strings x %d rounds\n", count, ROUNDS );
+    printf( "parseNumber: %8.2f ns/number\n", oursTime / total * 1e9 );
+    printf( "strtod:      %8.2f ns/number\n", strtodTime / total * 1e9 );
+    printf( "speedup:     %8.2fx\n", strtodTime / oursTime );
+    printf( "mismatches:  %d\n", mismatches );
+
+    for( int i = 0; i < count; i++ ) {
+        free(strings[i]);
+    }
+    free(strings);
+
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+# PostGen Output Size Benchmark
+#
+# Generates each benchmark workload and compares the size of the PostScript
+# written with absolute coordinates against --relative, at the default and at
+# a reduced precision.
+#
+# Usage: size_bench.sh [size]
+
+BIN=$(cd "$(dirname "$0")/../bin" && pwd)
+SIZE=${1:-1000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+cd "$DIR" || exit 1
+printf "%-8s %9s %12s %12s %8s\n" workload precision absolute relative saved
+for kind in trace shapes curves mixed; do
+    "$BIN/workload" $kind "$SIZE" > $kind.pscript || exit 1
+    for precision in 6 2; do
+        "$BIN/postgen" --precision $precision $kind.pscript > /dev/null || exit 1
+        absolute=$(wc -c < $kind.ps)
+        "$BIN/postgen" --precision $precision --relative $kind.pscript > /dev/null || exit 1
+        relative=$(wc -c < $kind.ps)
+        awk -v k=$kind -v p=$precision -v a=$absolute -v r=$relative \
+            'BEGIN { printf "%-8s %9d %12d %12d %7.1f%%\n", k, p, a, r, 100 * (a - r) / a }'
+    done
+done
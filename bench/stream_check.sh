@@ -0,0 +1,27 @@
+#!/bin/sh
+# PostGen Stream Check
+#
+# Streams a session of each benchmark workload to stdout with 'begin -', with
+# and without --jobs, and checks that the stream starts with the PostScript
+# header, so that none of the interpreter's own output is mixed into it.
+#
+# Usage: stream_check.sh [size]
+
+BIN=$(cd "$(dirname "$0")/../bin" && pwd)
+SIZE=${1:-100}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+cd "$DIR" || exit 1
+failed=0
+printf "%-8s %5s %8s\n" workload jobs clean
+for kind in trace shapes curves mixed; do
+    "$BIN/workload" $kind "$SIZE" | sed 's/^begin .*/begin -/' > $kind.pscript || exit 1
+    for jobs in 1 4; do
+        clean=yes
+        [ "$("$BIN/postgen" --jobs $jobs $kind.pscript 2> /dev/null | head -c 4)" = "%!PS" ] || clean=no
+        [ $clean = yes ] || failed=1
+        printf "%-8s %5d %8s\n" $kind $jobs $clean
+    done
+done
+exit $failed
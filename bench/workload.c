@@ -0,0 +1,137 @@
+/* PostGen Benchmark Workloads
+ *
+ * Generates PostGen scripts that resemble real workloads, for measuring the
+ * size and speed of the generated PostScript. The scripts are deterministic
+ * for a given kind, size and seed.
+ *
+ * Kinds:
+ * trace    - Long open paths, such as plotted measurements, that take small
+ *            fractional steps.
+ * shapes   - Many circles and polygons, filled and stroked, in varying styles.
+ * curves   - Many short bezier curves.
+ * mixed    - All of the above, inside loops and rotations.
+ *
+ * Usage: workload <kind> [size] [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The default number of shapes generated
+#define DEFAULT_SIZE 1000
+
+// The number of points in each trace
+#define TRACE_POINTS 200
+
+/*
+ * Gets a random number between two bounds.
+ */
+static double between( double low, double high ) {
+    return low + (high - low) * (rand() / (double)RAND_MAX);
+}
+
+/*
+ * Writes a long path that wanders across the page in small steps.
+ */
+static void trace( void ) {
+    double x = between( 50, 550 );
+    double y = between( 50, 750 );
+    printf( "path %.4f %.4f\n", x, y );
+    for( int i = 0; i < TRACE_POINTS; i++ ) {
+        x += between( 0.5, 3 );
+        y += between( -4, 4 );
+        printf( "%.4f %.4f\n", x, y );
+    }
+    printf( "done\n" );
+}
+
+/*
+ * Writes a circle or polygon, with an occasional change of style.
+ */
+static void shape( void ) {
+    if( rand() % 8 == 0 ) {
+        printf( "color %.2f %.2f %.2f\n", between( 0, 1 ), between( 0, 1 ), between( 0, 1 ) );
+    }
+    if( rand() % 16 == 0 ) {
+        printf( "linewidth %d\n", 1 + rand() % 4 );
+    }
+
+    const char* solid = rand() % 2 ? "solid" : "";
+    if( rand() % 2 ) {
+        printf( "%scircle %.2f %.2f %.2f\n", solid, between( 0, 600 ), between( 0, 800 ), between( 2, 40 ) );
+    } else {
+        printf( "%spolygon %.2f %.2f %.2f %d\n", solid, between( 0, 600 ), between( 0, 800 ),
+                between( 2, 40 ), 3 + rand() % 10 );
+    }
+}
+
+/*
+ * Writes a short bezier curve.
+ */
+static void curve( void ) {
+    double x = between( 0, 600 );
+    double y = between( 0, 800 );
+    printf( "curve %.3f %.3f\n", x, y );
+    for( int i = 0; i < 3; i++ ) {
+        printf( "%.3f %.3f\n", x + between( -30, 30 ), y + between( -30, 30 ) );
+    }
+    printf( "done\n" );
+}
+
+int main( int argc, char* argv[] ) {
+    if( argc < 2 ) {
+        fprintf( stderr, "Usage: workload <trace|shapes|curves|mixed> [size] [seed]\n" );
+        return EXIT_FAILURE;
+    }
+    const char* kind = argv[1];
+    int size = argc > 2 ? atoi(argv[2]) : DEFAULT_SIZE;
+    srand( argc > 3 ? atoi(argv[3]) : 42 );
+
+    printf( "begin %s\n", kind );
+    if( strcmp( kind, "trace" ) == 0 ) {
+        // Traces are much longer than other shapes
+        for( int i = 0; i < size / 20 + 1; i++ ) {
+            trace();
+        }
+    } else if( strcmp( kind, "shapes" ) == 0 ) {
+        for( int i = 0; i < size; i++ ) {
+            shape();
+        }
+    } else if( strcmp( kind, "curves" ) == 0 ) {
+        for( int i = 0; i < size; i++ ) {
+            curve();
+        }
+    } else if( strcmp( kind, "mixed" ) == 0 ) {
+        for( int i = 0; i < size; i++ ) {
+            switch( rand() % 16 ) {
+                case 0:
+                    trace();
+                    break;
+                case 1:
+                    printf( "loop %d {\n", 2 + rand() % 10 );
+                    printf( "rotate %d {\n", rand() % 90 );
+                    shape();
+                    printf( "}\n" );
+                    curve();
+                    printf( "}\n" );
+                    break;
+                case 2:
+                case 3:
+                case 4:
+                    curve();
+                    break;
+                default:
+                    shape();
+                    break;
+            }
+        }
+    } else {
+        fprintf( stderr, "Unknown workload: %s\n", kind );
+        return EXIT_FAILURE;
+    }
+    printf( "end\n" );
+    printf( "quit\n" );
+
+    return EXIT_SUCCESS;
+}
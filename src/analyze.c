@@ -0,0 +1,343 @@
+/* PostGen Analyze
+ *
+ * With --analyze, sessions are drawn through a backend that writes nothing,
+ * and instead counts the work a RIP does to render them: the segments of the
+ * paths it builds, the paints that fill or stroke them, and the gsave/grestore
+ * pairs around them.
+ *
+ * Loops are kept as they would be in PostScript, so their bodies are only
+ * drawn once however large the count, and what the body draws is counted
+ * once for every iteration of the loops it is nested in. Macros are expanded
+ * where they are invoked, so that loops counted by their parameters are
+ * counted correctly. Everything is attributed to the line of the command that
+ * drew it, such as the polygon within a loop or a macro, so that the report
+ * can point at the lines that cost the most.
+ *
+ * Sessions are drawn on a single thread when analyzing.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analyze.h"
+
+// What the RIP does for the commands on one source line
+typedef struct LineCost {
+    int line;
+    double segments;
+    double paints;
+    double saves;
+} LineCost;
+
+// Private function prototypes:
+
+static void begin( Writer* out );
+static void end( Writer* out );
+static void save( Writer* out );
+static void restore( Writer* out );
+static void rotate( Writer* out, Arg degrees );
+static void newPath( Writer* out );
+static void moveTo( Writer* out, Arg x, Arg y );
+static void lineTo( Writer* out, Arg x, Arg y );
+static void curveTo( Writer* out, const Arg points[6] );
+static void arc( Writer* out, Arg x, Arg y, Arg r );
+static void closePath( Writer* out );
+static void sync( Writer* out, unsigned parts );
+static void paint( Writer* out, bool solid );
+static void repeat( Writer* out, Arg times );
+static void endRepeat( Writer* out );
+// Helpers for counting
+static void count( double segments, double paints, double saves );
+static int compareCosts( const void* a, const void* b );
+
+// Everything but procedures, so that macros are expanded and every command
+// of the script is drawn
+const Backend analyzeBackend =
+        {
+            .name = "analyze",
+            .extension = "",
+            .features = BACKEND_PATTERNS | BACKEND_IMAGES | BACKEND_TEXT,
+            .begin = begin,
+            .end = end,
+            .save = save,
+            .restore = restore,
+            .rotate = rotate,
+            .newPath = newPath,
+            .moveTo = moveTo,
+            .lineTo = lineTo,
+            .curveTo = curveTo,
+            .arc = arc,
+            .closePath = closePath,
+            .sync = sync,
+            .paint = paint,
+            .repeat = repeat,
+            .endRepeat = endRepeat
+        };
+
+// The number of segments a RIP builds a full circle with
+#define ARC_SEGMENTS 4
+
+// Whether a session is being analyzed
+static bool active = false;
+
+// The line of the command being drawn. Commands are executed on worker
+// threads when not analyzing, so this is per thread.
+static _Thread_local int current = 0;
+
+// The cost of each line of the session, indexed by line
+static LineCost* costs = NULL;
+static int costCapacity = 0;
+
+// The number of times what is drawn is repeated, and what it was before each
+// of the loops being drawn
+static double multiplier = 1;
+static double* outer = NULL;
+static int depth = 0;
+static int outerCapacity = 0;
+
+/*
+ * Starts counting a new session.
+ */
+void begin( Writer* out ) {
+    (void)out;
+    active = true;
+    if( costs != NULL ) {
+        memset( costs, 0, costCapacity * sizeof(LineCost) );
+    }
+    multiplier = 1;
+    depth = 0;
+}
+
+/*
+ * Stops counting, until the next session.
+ */
+void end( Writer* out ) {
+    (void)out;
+    active = false;
+}
+
+/*
+ * Counts a gsave/grestore pair.
+ */
+void save( Writer* out ) {
+    (void)out;
+    count( 0, 0, 1 );
+}
+
+/*
+ * Counted with save.
+ */
+void restore( Writer* out ) {
+    (void)out;
+}
+
+/*
+ * Rotations only change the matrix points are transformed with, which costs
+ * the RIP nothing worth counting.
+ */
+void rotate( Writer* out, Arg degrees ) {
+    (void)out;
+    (void)degrees;
+}
+
+/*
+ * Starting a path costs nothing until it has segments.
+ */
+void newPath( Writer* out ) {
+    (void)out;
+}
+
+/*
+ * Counts the start of a subpath.
+ */
+void moveTo( Writer* out, Arg x, Arg y ) {
+    (void)out;
+    (void)x;
+    (void)y;
+    count( 1, 0, 0 );
+}
+
+/*
+ * Counts a line.
+ */
+void lineTo( Writer* out, Arg x, Arg y ) {
+    (void)out;
+    (void)x;
+    (void)y;
+    count( 1, 0, 0 );
+}
+
+/*
+ * Counts a curve.
+ */
+void curveTo( Writer* out, const Arg points[6] ) {
+    (void)out;
+    (void)points;
+    count( 1, 0, 0 );
+}
+
+/*
+ * Counts a full circle, as the curves the RIP builds it with.
+ */
+void arc( Writer* out, Arg x, Arg y, Arg r ) {
+    (void)out;
+    (void)x;
+    (void)y;
+    (void)r;
+    count( ARC_SEGMENTS, 0, 0 );
+}
+
+/*
+ * Counts the line that closes a subpath.
+ */
+void closePath( Writer* out ) {
+    (void)out;
+    count( 1, 0, 0 );
+}
+
+/*
+ * Style changes aren't counted.
+ */
+void sync( Writer* out, unsigned parts ) {
+    (void)out;
+    (void)parts;
+}
+
+/*
+ * Counts a fill or a stroke.
+ */
+void paint( Writer* out, bool solid ) {
+    (void)out;
+    (void)solid;
+    count( 0, 1, 0 );
+}
+
+/*
+ * Starts a loop, whose body is counted once for each iteration. A loop whose
+ * count can't be kept track of is counted as if it ran once.
+ */
+void repeat( Writer* out, Arg times ) {
+    (void)out;
+    if( depth >= outerCapacity ) {
+        int capacity = outerCapacity > 0 ? outerCapacity * 2 : 16;
+        double* grown = (double*)realloc( outer, capacity * sizeof(double) );
+        if( grown == NULL ) {
+            depth++;
+            return;
+        }
+        outer = grown;
+        outerCapacity = capacity;
+    }
+
+    outer[depth++] = multiplier;
+    multiplier *= times.value;
+}
+
+/*
+ * Ends the loop started by repeat.
+ */
+void endRepeat( Writer* out ) {
+    (void)out;
+    if( depth > 0 && --depth < outerCapacity ) {
+        multiplier = outer[depth];
+    }
+}
+
+/*
+ * Sets the source line that what is drawn next is attributed to.
+ *
+ * Input:
+ * int line - The line of the command being executed.
+ */
+void analyzeLine( int line ) {
+    current = line;
+}
+
+/*
+ * Counts a paint that isn't drawn through the backend, such as text, an
+ * image or a pattern fill. Does nothing when not analyzing.
+ */
+void analyzePaint( void ) {
+    if(active) {
+        count( 0, 1, 0 );
+    }
+}
+
+/*
+ * Prints the cost of the session that was analyzed last, followed by the
+ * lines that cost the most, most expensive first.
+ */
+void analyzeReport( void ) {
+    LineCost total = { 0 };
+    LineCost* top = (LineCost*)malloc( (costCapacity > 0 ? costCapacity : 1) * sizeof(LineCost) );
+    int lines = 0;
+    for( int i = 0; i < costCapacity; i++ ) {
+        total.segments += costs[i].segments;
+        total.paints += costs[i].paints;
+        total.saves += costs[i].saves;
+        if( top != NULL && costs[i].segments + costs[i].paints + costs[i].saves > 0 ) {
+            top[lines] = costs[i];
+            top[lines++].line = i;
+        }
+    }
+
+    printf( "Render cost: %.0f path segments, %.0f paints, %.0f gsave/grestore pairs.\n",
+            total.segments, total.paints, total.saves );
+    if( lines > 0 ) {
+        qsort( top, lines, sizeof(LineCost), compareCosts );
+        printf( "%8s %16s %16s %16s\n", "Line", "Segments", "Paints", "Saves" );
+        for( int i = 0; i < lines && i < ANALYZE_TOP_LINES; i++ ) {
+            printf( "%8d %16.0f %16.0f %16.0f\n", top[i].line, top[i].segments, top[i].paints, top[i].saves );
+        }
+    }
+    free(top);
+}
+
+/*
+ * Adds to the cost of the current line, for every iteration of the loops
+ * being drawn.
+ *
+ * Input:
+ * double segments - The number of path segments.
+ * double paints   - The number of fills and strokes.
+ * double saves    - The number of gsave/grestore pairs.
+ */
+void count( double segments, double paints, double saves ) {
+    if( current < 0 ) {
+        return;
+    }
+
+    if( current >= costCapacity ) {
+        int capacity = costCapacity > 0 ? costCapacity : 64;
+        while( capacity <= current ) {
+            capacity *= 2;
+        }
+        LineCost* grown = (LineCost*)realloc( costs, capacity * sizeof(LineCost) );
+        if( grown == NULL ) {
+            return;
+        }
+        memset( grown + costCapacity, 0, (capacity - costCapacity) * sizeof(LineCost) );
+        costs = grown;
+        costCapacity = capacity;
+    }
+
+    costs[current].segments += segments * multiplier;
+    costs[current].paints += paints * multiplier;
+    costs[current].saves += saves * multiplier;
+}
+
+/*
+ * Orders line costs from the most expensive to the least, and then by line.
+ */
+int compareCosts( const void* a, const void* b ) {
+    const LineCost* first = (const LineCost*)a;
+    const LineCost* second = (const LineCost*)b;
+    double firstTotal = first->segments + first->paints + first->saves;
+    double secondTotal = second->segments + second->paints + second->saves;
+    if( firstTotal != secondTotal ) {
+        return firstTotal > secondTotal ? -1 : 1;
+    }
+    return first->line - second->line;
+}
@@ -0,0 +1,29 @@
+/* PostGen Analyze
+ *
+ * Provides an estimate of how much work a RIP does to render a session, in
+ * place of writing it.
+ */
+
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include "backend.h"
+
+// The number of source lines listed in the report
+#define ANALYZE_TOP_LINES 10
+
+// The backend that counts what a session draws rather than writing it
+extern const Backend analyzeBackend;
+
+// Public function prototypes:
+
+// Sets the source line that what is drawn next is attributed to
+void analyzeLine( int line );
+
+// Counts a paint that isn't drawn through the backend, such as text
+void analyzePaint( void );
+
+// Prints the cost of the session, and the lines that cost the most
+void analyzeReport( void );
+
+#endif
@@ -0,0 +1,36 @@
+/* PostGen Backend
+ *
+ * Keeps the list of output formats that sessions can be written in. See
+ * psbackend.c and svgbackend.c for the formats themselves.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "backend.h"
+
+// List of the available backends, the first being the default
+static const Backend* backends[] =
+        {
+            &postscriptBackend,
+            &svgBackend
+        };
+
+/*
+ * Looks up a backend by name.
+ *
+ * Input:
+ * const char* name - The name of the backend, such as "ps".
+ *
+ * Returns:
+ * The backend, or NULL if there is no backend of that name.
+ */
+const Backend* findBackend( const char* name ) {
+    for( size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++ ) {
+        if( strcmp( backends[i]->name, name ) == 0 ) {
+            return backends[i];
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,71 @@
+/* PostGen Backend
+ *
+ * Provides the output formats that sessions can be written in. The command
+ * states draw through a backend, which writes the operators of its format.
+ */
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdbool.h>
+
+#include "writer.h"
+
+// Features of a format beyond drawing paths. The commands that need a feature
+// the format of the session doesn't have report an error instead.
+#define BACKEND_PROCEDURES 0x1
+#define BACKEND_PATTERNS   0x2
+#define BACKEND_IMAGES     0x4
+#define BACKEND_TEXT       0x8
+
+// A numeric argument. Within a macro compiled into a procedure, it may be the
+// name of a parameter, whose value is only known when the procedure runs.
+typedef struct Arg {
+    double value;
+    const char* param;
+} Arg;
+
+// An output format. Coordinates are in PostScript's default user space, with
+// the origin at the bottom left of the page.
+typedef struct Backend {
+    // The name the backend is selected by, and the extension of its files
+    const char* name;
+    const char* extension;
+    unsigned features;
+    // Starts and finishes the page
+    void (*begin)( Writer* out );
+    void (*end)( Writer* out );
+    // Saves the coordinate system and style, and brings them back
+    void (*save)( Writer* out );
+    void (*restore)( Writer* out );
+    // Rotates the coordinate system until the next restore
+    void (*rotate)( Writer* out, Arg degrees );
+    // Builds the current path
+    void (*newPath)( Writer* out );
+    void (*moveTo)( Writer* out, Arg x, Arg y );
+    void (*lineTo)( Writer* out, Arg x, Arg y );
+    // Adds a cubic curve, given its two control points and its end
+    void (*curveTo)( Writer* out, const Arg points[6] );
+    // Adds a full circle
+    void (*arc)( Writer* out, Arg x, Arg y, Arg r );
+    void (*closePath)( Writer* out );
+    // Writes any of the given parts of the requested style that have changed
+    void (*sync)( Writer* out, unsigned parts );
+    // Fills or strokes the current path with the requested style
+    void (*paint)( Writer* out, bool solid );
+    // Repeats the block written until endRepeat. Formats without loops leave
+    // these NULL, and get every iteration written out instead.
+    void (*repeat)( Writer* out, Arg count );
+    void (*endRepeat)( Writer* out );
+} Backend;
+
+// The backends that are available
+extern const Backend postscriptBackend;
+extern const Backend svgBackend;
+
+// Public function prototypes:
+
+// Looks up a backend by name
+const Backend* findBackend( const char* name );
+
+#endif
@@ -0,0 +1,233 @@
+/* PostGen Cache
+ *
+ * Output is kept in a hash table, keyed by a description of the shape and the
+ * graphics state it was generated in, so that a shape is only reused when it
+ * would generate exactly the same output. Each run of a script marks the
+ * entries it uses, and the ones it doesn't are forgotten at the end, so the
+ * cache only ever holds the shapes of the latest run.
+ *
+ * Shapes may be generated on worker threads, so the table is guarded by a
+ * lock.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cache.h"
+
+// The number of buckets the table starts with
+#define CACHE_BUCKETS 1024
+
+// The output kept for a shape
+typedef struct Entry {
+    uint64_t hash;
+    char* key;
+    size_t keyLength;
+    char* data;
+    size_t length;
+    // The run the entry was last used in
+    unsigned long run;
+    struct Entry* next;
+} Entry;
+
+// Guards everything below
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Entry** buckets = NULL;
+static size_t bucketCount = 0;
+static size_t entryCount = 0;
+
+// The current run, and what it did so far
+static unsigned long run = 0;
+static CacheStats stats;
+
+// Private function prototypes:
+
+static uint64_t hashKey( const char* key, size_t length );
+static Entry* find( uint64_t hash, const char* key, size_t length );
+static void grow( void );
+
+/*
+ * Starts a run of a script. Entries that aren't used before the next sweep
+ * are forgotten.
+ */
+void cacheBegin( void ) {
+    pthread_mutex_lock( &lock );
+    run++;
+    memset( &stats, 0, sizeof(stats) );
+    pthread_mutex_unlock( &lock );
+}
+
+/*
+ * Writes the output kept for a key, if there is any, and marks it as used.
+ *
+ * Input:
+ * const char* key  - The description of the shape.
+ * size_t keyLength - The length of the key.
+ * Writer* out      - Where to write the output.
+ *
+ * Returns:
+ * True if output was found and written.
+ */
+bool cacheFind( const char* key, size_t keyLength, Writer* out ) {
+    uint64_t hash = hashKey( key, keyLength );
+
+    pthread_mutex_lock( &lock );
+    Entry* entry = find( hash, key, keyLength );
+    if( entry != NULL ) {
+        entry->run = run;
+        writerWrite( out, entry->data, entry->length );
+        stats.reused++;
+    }
+    pthread_mutex_unlock( &lock );
+
+    return entry != NULL;
+}
+
+/*
+ * Keeps the output generated for a key. If the same key is stored twice, as
+ * when a script draws the same shape again, the first is kept.
+ *
+ * Input:
+ * char* key         - The description of the shape. The cache takes ownership.
+ * size_t keyLength  - The length of the key.
+ * const char* data  - The output generated for the shape, which is copied.
+ * size_t length     - The length of the output.
+ */
+void cacheStore( char* key, size_t keyLength, const char* data, size_t length ) {
+    uint64_t hash = hashKey( key, keyLength );
+
+    pthread_mutex_lock( &lock );
+    stats.generated++;
+    if( find( hash, key, keyLength ) != NULL ) {
+        pthread_mutex_unlock( &lock );
+        free(key);
+        return;
+    }
+
+    // Shapes that can't be kept are simply generated again next time
+    Entry* entry = (Entry*)malloc(sizeof(Entry));
+    char* copy = (char*)malloc( length > 0 ? length : 1 );
+    if( entry == NULL || copy == NULL ) {
+        pthread_mutex_unlock( &lock );
+        free(entry);
+        free(copy);
+        free(key);
+        return;
+    }
+    memcpy( copy, data, length );
+
+    if( entryCount >= bucketCount ) {
+        grow();
+    }
+    if( bucketCount == 0 ) {
+        pthread_mutex_unlock( &lock );
+        free(entry);
+        free(copy);
+        free(key);
+        return;
+    }
+
+    entry->hash = hash;
+    entry->key = key;
+    entry->keyLength = keyLength;
+    entry->data = copy;
+    entry->length = length;
+    entry->run = run;
+    entry->next = buckets[hash % bucketCount];
+    buckets[hash % bucketCount] = entry;
+    entryCount++;
+    pthread_mutex_unlock( &lock );
+}
+
+/*
+ * Forgets the output of shapes that weren't used since the run started,
+ * which are the shapes that were changed or removed.
+ *
+ * A run that generated nothing, such as one of a script that failed to
+ * parse, forgets nothing.
+ *
+ * Input:
+ * CacheStats* result - Set to what the run did.
+ */
+void cacheSweep( CacheStats* result ) {
+    pthread_mutex_lock( &lock );
+    for( size_t i = 0; i < bucketCount && stats.reused + stats.generated > 0; i++ ) {
+        Entry** link = &buckets[i];
+        while( *link != NULL ) {
+            Entry* entry = *link;
+            if( entry->run == run ) {
+                link = &entry->next;
+                continue;
+            }
+
+            *link = entry->next;
+            free( entry->key );
+            free( entry->data );
+            free(entry);
+            entryCount--;
+            stats.forgotten++;
+        }
+    }
+    *result = stats;
+    pthread_mutex_unlock( &lock );
+}
+
+/*
+ * Hashes a key with FNV-1a.
+ */
+uint64_t hashKey( const char* key, size_t length ) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for( size_t i = 0; i < length; i++ ) {
+        hash ^= (unsigned char)key[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*
+ * Finds the entry for a key. The lock must be held.
+ */
+Entry* find( uint64_t hash, const char* key, size_t length ) {
+    if( bucketCount == 0 ) {
+        return NULL;
+    }
+
+    for( Entry* entry = buckets[hash % bucketCount]; entry != NULL; entry = entry->next ) {
+        if( entry->hash == hash && entry->keyLength == length && memcmp( entry->key, key, length ) == 0 ) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Doubles the number of buckets, moving every entry to its new bucket. If
+ * there isn't enough memory, the table is left as it is. The lock must be
+ * held.
+ */
+void grow( void ) {
+    size_t count = bucketCount > 0 ? bucketCount * 2 : CACHE_BUCKETS;
+    Entry** grown = (Entry**)calloc( count, sizeof(Entry*) );
+    if( grown == NULL ) {
+        return;
+    }
+
+    for( size_t i = 0; i < bucketCount; i++ ) {
+        Entry* entry = buckets[i];
+        while( entry != NULL ) {
+            Entry* next = entry->next;
+            entry->next = grown[entry->hash % count];
+            grown[entry->hash % count] = entry;
+            entry = next;
+        }
+    }
+
+    free(buckets);
+    buckets = grown;
+    bucketCount = count;
+}
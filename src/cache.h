@@ -0,0 +1,36 @@
+/* PostGen Cache
+ *
+ * Keeps the output generated for shapes, so that when a script is run again
+ * the shapes that haven't changed can be written without being generated.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "writer.h"
+
+// The number of shapes reused and generated during a run
+typedef struct CacheStats {
+    int reused;
+    int generated;
+    int forgotten;
+} CacheStats;
+
+// Public function prototypes:
+
+// Starts a run of a script
+void cacheBegin( void );
+
+// Writes the output kept for a key, if there is any
+bool cacheFind( const char* key, size_t keyLength, Writer* out );
+
+// Keeps the output generated for a key
+void cacheStore( char* key, size_t keyLength, const char* data, size_t length );
+
+// Forgets the output of shapes that weren't used since the run started
+void cacheSweep( CacheStats* stats );
+
+#endif
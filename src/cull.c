@@ -0,0 +1,631 @@
+/* PostGen Culling
+ *
+ * When culling, the output of a page is buffered until the session ends. Each
+ * top-level shape is kept as a separate chunk of output, along with a
+ * description of what it paints: the bounding box of everything it paints,
+ * and the convex areas it fills. Since every top-level shape is wrapped in
+ * gsave/grestore, leaving one out doesn't affect any of the others.
+ *
+ * Shapes are described as they are written, in the coordinates of the page:
+ * points are rotated by the rotations in effect, and what a loop body paints
+ * is repeated, rotated, for each of its iterations. A shape that paints
+ * something that can't be described, such as a macro, is never culled.
+ *
+ * When the page is finished, it is scanned from the last shape to the first,
+ * keeping the largest convex fills seen so far. A shape whose bounding box is
+ * entirely within one of them is hidden, since PostScript fills are opaque,
+ * and is left out. Both tests are conservative, so the rendered page is
+ * unchanged.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "cull.h"
+
+// The most sides a fill may have and still be used to hide shapes. Fills
+// with more sides are approximated by a subset of their corners.
+#define MAX_COVER_SIDES 32
+
+// The most fills kept to hide earlier shapes with, per shape and per page
+#define MAX_COVERS 16
+
+// The most paints a single top-level shape may be described with
+#define MAX_SHAPE_PAINTS 4096
+
+// How far inside a fill a shape must be to be hidden. This covers rounding,
+// and the flattening of curves by the RIP.
+#define CULL_MARGIN 1.0
+
+// A convex area that is filled, with its corners counterclockwise
+typedef struct Cover {
+    int sides;
+    double corners[MAX_COVER_SIDES][2];
+    double area;
+} Cover;
+
+// Something painted by a shape
+typedef struct Paint {
+    double box[4];
+    bool covers;
+    Cover cover;
+} Paint;
+
+// A chunk of the page's output
+typedef struct Chunk {
+    char* data;
+    size_t length;
+    // Whether the chunk is a top-level shape, and what it paints is known
+    bool shape;
+    bool known;
+    double box[4];
+    int coverc;
+    Cover* covers;
+} Chunk;
+
+// The chunks of the page
+static Chunk* chunks = NULL;
+static int chunkCount = 0;
+static int chunkCapacity = 0;
+
+// The shape being described
+static bool building = false;
+static bool unknown = false;
+static double angle = 0;
+static Paint* paints = NULL;
+static int paintCount = 0;
+
+// The current path of the shape
+static double (*points)[2] = NULL;
+static int pointCount = 0;
+static int pointCapacity = 0;
+static double pathBox[4];
+static bool curved = false;
+
+// Private function prototypes:
+
+static void addChunk( Writer* from, bool shape );
+static void emptyBox( double box[4] );
+static void addToBox( double box[4], double x, double y );
+static void turn( double degrees, double x, double y, double* outX, double* outY );
+static bool makeCover( Cover* cover );
+static bool insideCover( const Cover* cover, const double box[4] );
+static void clearPath( void );
+
+/*
+ * Starts buffering a new page, discarding any previous one.
+ */
+void cullReset( void ) {
+    for( int i = 0; i < chunkCount; i++ ) {
+        free( chunks[i].data );
+        free( chunks[i].covers );
+    }
+    chunkCount = 0;
+    building = false;
+}
+
+/*
+ * Takes output that must be kept, such as style changes and procedures.
+ *
+ * Input:
+ * Writer* from - The memory writer the output was written to.
+ */
+void cullKeep( Writer* from ) {
+    addChunk( from, false );
+}
+
+/*
+ * Starts describing a top-level shape. Its output is taken once it's done.
+ */
+void cullStart( void ) {
+    if( paints == NULL ) {
+        paints = (Paint*)malloc( MAX_SHAPE_PAINTS * sizeof(Paint) );
+    }
+
+    building = true;
+    unknown = paints == NULL;
+    angle = 0;
+    paintCount = 0;
+    clearPath();
+}
+
+/*
+ * Takes the output of the shape that was described.
+ *
+ * Input:
+ * Writer* from - The memory writer the shape was written to.
+ */
+void cullEnd( Writer* from ) {
+    addChunk( from, true );
+    building = false;
+}
+
+/*
+ * Adds a point of the current path.
+ *
+ * Input:
+ * double x, y - The point, in the current coordinate system.
+ */
+void cullPoint( double x, double y ) {
+    if( !building ) {
+        return;
+    }
+
+    if( pointCount == pointCapacity ) {
+        int capacity = pointCapacity > 0 ? pointCapacity * 2 : 64;
+        double (*grown)[2] = realloc( points, capacity * sizeof(*points) );
+        if( grown == NULL ) {
+            unknown = true;
+            return;
+        }
+        points = grown;
+        pointCapacity = capacity;
+    }
+
+    turn( angle, x, y, &points[pointCount][0], &points[pointCount][1] );
+    addToBox( pathBox, points[pointCount][0], points[pointCount][1] );
+    pointCount++;
+}
+
+/*
+ * Adds a circle to the current path. The circle is bounded by a square, and
+ * fills the polygon inscribed in it.
+ *
+ * Input:
+ * double x, y - The center of the circle, in the current coordinate system.
+ * double r    - The radius of the circle.
+ */
+void cullArc( double x, double y, double r ) {
+    if( !building ) {
+        return;
+    }
+
+    r = fabs(r);
+    for( int i = 0; i < MAX_COVER_SIDES; i++ ) {
+        double a = 2.0 * M_PI * i / MAX_COVER_SIDES;
+        cullPoint( x + r * cos(a), y + r * sin(a) );
+    }
+
+    double cx, cy;
+    turn( angle, x, y, &cx, &cy );
+    addToBox( pathBox, cx - r, cy - r );
+    addToBox( pathBox, cx + r, cy + r );
+}
+
+/*
+ * Marks the current path as curved. Its points then only bound it, rather
+ * than outlining it.
+ */
+void cullCurve( void ) {
+    curved = true;
+}
+
+/*
+ * Paints the current path, and starts a new one.
+ *
+ * Input:
+ * bool solid   - Whether the path is filled, or stroked.
+ * double width - The line width the path is stroked with.
+ */
+void cullPaint( bool solid, double width ) {
+    if( !building ) {
+        return;
+    }
+    if( paintCount == MAX_SHAPE_PAINTS ) {
+        unknown = true;
+        clearPath();
+        return;
+    }
+
+    Paint* paint = &paints[paintCount];
+    memcpy( paint->box, pathBox, sizeof(pathBox) );
+
+    // Strokes may extend past the path by up to half the miter limit
+    // (10 by default) times the line width
+    if( !solid && pointCount > 0 ) {
+        double margin = width * 5;
+        paint->box[0] -= margin;
+        paint->box[1] -= margin;
+        paint->box[2] += margin;
+        paint->box[3] += margin;
+    }
+
+    paint->covers = solid && !curved && makeCover( &paint->cover );
+    paintCount++;
+    clearPath();
+}
+
+/*
+ * Rotates the coordinate system, as with the rotate operator.
+ *
+ * Input:
+ * double degrees - The angle to rotate by, counterclockwise.
+ */
+void cullRotate( double degrees ) {
+    if(building) {
+        angle += degrees;
+    }
+}
+
+/*
+ * Marks the start of a loop body.
+ *
+ * Returns:
+ * The mark to give to cullRepeat once the body has been written.
+ */
+CullMark cullMark( void ) {
+    CullMark mark = { paintCount, angle };
+    return mark;
+}
+
+/*
+ * Repeats what a loop body painted for the rest of its iterations. The body
+ * was described once, and each iteration starts rotated by however much the
+ * body rotates.
+ *
+ * Input:
+ * CullMark mark - The mark taken at the start of the body.
+ * long count    - The number of iterations.
+ */
+void cullRepeat( CullMark mark, long count ) {
+    if( !building ) {
+        return;
+    }
+
+    // A body that is never run paints nothing
+    if( count <= 0 ) {
+        paintCount = mark.paints;
+        angle = mark.angle;
+        return;
+    }
+
+    double delta = angle - mark.angle;
+    int body = paintCount - mark.paints;
+    if( body == 0 || fmod( delta, 360 ) == 0 ) {
+        // Every iteration paints the same thing
+        angle = mark.angle + delta * count;
+        return;
+    }
+
+    if( count - 1 > (MAX_SHAPE_PAINTS - paintCount) / body ) {
+        unknown = true;
+        return;
+    }
+
+    for( long k = 1; k < count; k++ ) {
+        for( int i = mark.paints; i < mark.paints + body; i++ ) {
+            Paint* from = &paints[i];
+            Paint* to = &paints[paintCount++];
+
+            // Bound the turned box by its turned corners
+            emptyBox( to->box );
+            for( int corner = 0; corner < 4; corner++ ) {
+                double x, y;
+                turn( delta * k, from->box[(corner & 1) ? 2 : 0], from->box[(corner & 2) ? 3 : 1], &x, &y );
+                addToBox( to->box, x, y );
+            }
+
+            to->covers = from->covers;
+            if( from->covers ) {
+                to->cover = from->cover;
+                for( int j = 0; j < from->cover.sides; j++ ) {
+                    turn( delta * k, from->cover.corners[j][0], from->cover.corners[j][1],
+                          &to->cover.corners[j][0], &to->cover.corners[j][1] );
+                }
+            }
+        }
+    }
+    angle = mark.angle + delta * count;
+}
+
+/*
+ * Marks the current shape as painting something that can't be described,
+ * so that it is never culled.
+ */
+void cullUnknown( void ) {
+    if(building) {
+        unknown = true;
+    }
+}
+
+/*
+ * Writes the shapes of the page that aren't hidden by later fills, along with
+ * everything else that was kept, then frees the page.
+ *
+ * Input:
+ * Writer* out       - Where to write the page.
+ * CullStats* stats  - Used to return the number of shapes and bytes culled.
+ *
+ * Returns:
+ * False if the page couldn't be written.
+ */
+bool cullFinish( Writer* out, CullStats* stats ) {
+    memset( stats, 0, sizeof(CullStats) );
+
+    // The largest fills after the chunk being checked
+    const Cover* covers[MAX_COVERS];
+    int coverc = 0;
+    bool* culled = (bool*)calloc( chunkCount > 0 ? chunkCount : 1, sizeof(bool) );
+
+    for( int i = chunkCount - 1; i >= 0 && culled != NULL; i-- ) {
+        Chunk* chunk = &chunks[i];
+        stats->bytes += chunk->length;
+        if( !chunk->shape ) {
+            continue;
+        }
+        stats->shapes++;
+
+        if( chunk->known ) {
+            if( chunk->box[0] > chunk->box[2] ) {
+                // Nothing is painted at all
+                culled[i] = true;
+            }
+            for( int j = 0; j < coverc && !culled[i]; j++ ) {
+                culled[i] = insideCover( covers[j], chunk->box );
+            }
+        }
+
+        if( culled[i] ) {
+            stats->culled++;
+            stats->culledBytes += chunk->length;
+            continue;
+        }
+
+        // Keep the largest of this shape's fills for the shapes before it
+        for( int j = 0; j < chunk->coverc; j++ ) {
+            const Cover* cover = &chunk->covers[j];
+            if( coverc < MAX_COVERS ) {
+                covers[coverc++] = cover;
+                continue;
+            }
+            int smallest = 0;
+            for( int k = 1; k < coverc; k++ ) {
+                if( covers[k]->area < covers[smallest]->area ) {
+                    smallest = k;
+                }
+            }
+            if( cover->area > covers[smallest]->area ) {
+                covers[smallest] = cover;
+            }
+        }
+    }
+
+    // Write everything that's left, in order
+    for( int i = 0; i < chunkCount; i++ ) {
+        if( culled == NULL || !culled[i] ) {
+            writerWrite( out, chunks[i].data, chunks[i].length );
+        }
+    }
+
+    free(culled);
+    cullReset();
+    return writerError(out) == 0;
+}
+
+/*
+ * Takes the output collected by a memory writer as a new chunk of the page.
+ *
+ * Input:
+ * Writer* from - The memory writer.
+ * bool shape   - Whether the output is the shape being described.
+ */
+void addChunk( Writer* from, bool shape ) {
+    size_t length;
+    char* data = writerTake( from, &length );
+    if( data == NULL || (length == 0 && !shape) ) {
+        free(data);
+        return;
+    }
+
+    if( chunkCount == chunkCapacity ) {
+        int capacity = chunkCapacity > 0 ? chunkCapacity * 2 : 256;
+        Chunk* grown = (Chunk*)realloc( chunks, capacity * sizeof(Chunk) );
+        if( grown == NULL ) {
+            // Write what there is so far, so nothing is lost
+            free(data);
+            return;
+        }
+        chunks = grown;
+        chunkCapacity = capacity;
+    }
+
+    Chunk* chunk = &chunks[chunkCount++];
+    chunk->data = data;
+    chunk->length = length;
+    chunk->shape = shape;
+    chunk->known = shape && !unknown;
+    chunk->coverc = 0;
+    chunk->covers = NULL;
+    if( !shape ) {
+        return;
+    }
+
+    // Bound everything the shape paints, with room for rounding
+    emptyBox( chunk->box );
+    for( int i = 0; i < paintCount; i++ ) {
+        addToBox( chunk->box, paints[i].box[0] - CULL_MARGIN, paints[i].box[1] - CULL_MARGIN );
+        addToBox( chunk->box, paints[i].box[2] + CULL_MARGIN, paints[i].box[3] + CULL_MARGIN );
+    }
+
+    // Keep the shape's largest fills
+    const Cover* best[MAX_COVERS];
+    int bestc = 0;
+    for( int i = 0; i < paintCount; i++ ) {
+        if( !paints[i].covers ) {
+            continue;
+        }
+        const Cover* cover = &paints[i].cover;
+        if( bestc < MAX_COVERS ) {
+            best[bestc++] = cover;
+        } else {
+            int smallest = 0;
+            for( int j = 1; j < bestc; j++ ) {
+                if( best[j]->area < best[smallest]->area ) {
+                    smallest = j;
+                }
+            }
+            if( cover->area > best[smallest]->area ) {
+                best[smallest] = cover;
+            }
+        }
+    }
+    if( bestc > 0 ) {
+        chunk->covers = (Cover*)malloc( bestc * sizeof(Cover) );
+        if( chunk->covers != NULL ) {
+            for( int i = 0; i < bestc; i++ ) {
+                chunk->covers[i] = *best[i];
+            }
+            chunk->coverc = bestc;
+        }
+    }
+}
+
+/*
+ * Makes a box empty, so that adding any point to it makes it that point.
+ *
+ * Input:
+ * double box[4] - The box.
+ */
+void emptyBox( double box[4] ) {
+    box[0] = box[1] = INFINITY;
+    box[2] = box[3] = -INFINITY;
+}
+
+/*
+ * Grows a box to include a point.
+ *
+ * Input:
+ * double box[4] - The box.
+ * double x, y   - The point.
+ */
+void addToBox( double box[4], double x, double y ) {
+    box[0] = fmin( box[0], x );
+    box[1] = fmin( box[1], y );
+    box[2] = fmax( box[2], x );
+    box[3] = fmax( box[3], y );
+}
+
+/*
+ * Rotates a point about the origin.
+ *
+ * Input:
+ * double degrees         - The angle to rotate by, counterclockwise.
+ * double x, y            - The point.
+ * double* outX, outY     - Used to return the rotated point.
+ */
+void turn( double degrees, double x, double y, double* outX, double* outY ) {
+    if( degrees == 0 ) {
+        *outX = x;
+        *outY = y;
+        return;
+    }
+
+    double a = degrees * M_PI / 180.0;
+    *outX = x * cos(a) - y * sin(a);
+    *outY = x * sin(a) + y * cos(a);
+}
+
+/*
+ * Makes a cover from the current path, if it outlines a convex polygon.
+ *
+ * Input:
+ * Cover* cover - Used to return the cover.
+ *
+ * Returns:
+ * True if the path is convex, false otherwise.
+ */
+bool makeCover( Cover* cover ) {
+    // Drop repeated points, including a last point that closes the path
+    int n = 0;
+    for( int i = 0; i < pointCount; i++ ) {
+        if( n > 0 && points[i][0] == points[n - 1][0] && points[i][1] == points[n - 1][1] ) {
+            continue;
+        }
+        points[n][0] = points[i][0];
+        points[n][1] = points[i][1];
+        n++;
+    }
+    while( n > 1 && points[n - 1][0] == points[0][0] && points[n - 1][1] == points[0][1] ) {
+        n--;
+    }
+    if( n < 3 ) {
+        return false;
+    }
+
+    // A convex polygon turns the same way at every corner, and all the way
+    // around exactly once
+    int sign = 0;
+    double turning = 0;
+    double area = 0;
+    for( int i = 0; i < n; i++ ) {
+        double* a = points[i];
+        double* b = points[(i + 1) % n];
+        double* c = points[(i + 2) % n];
+        double cross = (b[0] - a[0]) * (c[1] - b[1]) - (b[1] - a[1]) * (c[0] - b[0]);
+        double dot = (b[0] - a[0]) * (c[0] - b[0]) + (b[1] - a[1]) * (c[1] - b[1]);
+        if( cross != 0 ) {
+            if( sign != 0 && (cross > 0) != (sign > 0) ) {
+                return false;
+            }
+            sign = cross > 0 ? 1 : -1;
+        }
+        turning += atan2( cross, dot );
+        area += a[0] * b[1] - b[0] * a[1];
+    }
+    if( sign == 0 || fabs( fabs(turning) - 2.0 * M_PI ) > 1e-6 ) {
+        return false;
+    }
+
+    // Any subset of the corners outlines a convex polygon within it
+    cover->sides = n < MAX_COVER_SIDES ? n : MAX_COVER_SIDES;
+    for( int i = 0; i < cover->sides; i++ ) {
+        // Keep the corners counterclockwise
+        int from = (int)((long)i * n / cover->sides);
+        if( sign < 0 ) {
+            from = n - 1 - from;
+        }
+        cover->corners[i][0] = points[from][0];
+        cover->corners[i][1] = points[from][1];
+    }
+    cover->area = fabs(area) / 2;
+
+    return true;
+}
+
+/*
+ * Checks if a box is entirely within a cover.
+ *
+ * Input:
+ * const Cover* cover  - The cover.
+ * const double box[4] - The box.
+ *
+ * Returns:
+ * True if every corner of the box is within the cover.
+ */
+bool insideCover( const Cover* cover, const double box[4] ) {
+    for( int corner = 0; corner < 4; corner++ ) {
+        double x = box[(corner & 1) ? 2 : 0];
+        double y = box[(corner & 2) ? 3 : 1];
+        for( int i = 0; i < cover->sides; i++ ) {
+            const double* a = cover->corners[i];
+            const double* b = cover->corners[(i + 1) % cover->sides];
+            if( (b[0] - a[0]) * (y - a[1]) - (b[1] - a[1]) * (x - a[0]) < 0 ) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Starts a new, empty path.
+ */
+void clearPath( void ) {
+    pointCount = 0;
+    curved = false;
+    emptyBox( pathBox );
+}
@@ -0,0 +1,70 @@
+/* PostGen Culling
+ *
+ * Buffers the shapes of a page so that shapes hidden under later opaque fills
+ * can be left out of the generated file.
+ */
+
+#ifndef CULL_H
+#define CULL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "writer.h"
+
+// The number of shapes on a page that were culled
+typedef struct CullStats {
+    int shapes;
+    int culled;
+    size_t bytes;
+    size_t culledBytes;
+} CullStats;
+
+// The point a loop started at, used to repeat what it painted
+typedef struct CullMark {
+    int paints;
+    double angle;
+} CullMark;
+
+// Public function prototypes:
+
+// Starts buffering a new page
+void cullReset( void );
+
+// Takes output that must be kept, such as style changes and procedures
+void cullKeep( Writer* from );
+
+// Starts describing a top-level shape
+void cullStart( void );
+
+// Takes the output of the shape that was described
+void cullEnd( Writer* from );
+
+// Adds a point of the current path
+void cullPoint( double x, double y );
+
+// Adds a circle to the current path
+void cullArc( double x, double y, double r );
+
+// Marks the current path as curved, so its points only bound it
+void cullCurve( void );
+
+// Paints the current path
+void cullPaint( bool solid, double width );
+
+// Rotates the coordinate system
+void cullRotate( double degrees );
+
+// Marks the start of a loop body
+CullMark cullMark( void );
+
+// Repeats what a loop body painted for the rest of its iterations
+void cullRepeat( CullMark mark, long count );
+
+// Marks the current shape as painting something that can't be analyzed
+void cullUnknown( void );
+
+// Writes the shapes of the page that aren't hidden, and frees the page
+bool cullFinish( Writer* out, CullStats* stats );
+
+#endif
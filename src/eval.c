@@ -5,62 +5,235 @@
  * This file contains the interpreters main eval loop, and all logic for
  * interpreting and executing user inputted commands and script files.
  *
- * All supported commands have their own function that acts as a state.  When a
- * command is received by the eval loop, it is compared to a list of commands
- * and then executes the corresponding function from a list of function
- * pointers. The same is true of a script file as it is parsed.
+ * All supported commands have their own function that acts as a state.  Input
+ * is first parsed into a tree of commands (see parser.c). When a command is
+ * executed, it is compared to a list of commands and then executes the
+ * corresponding function from a list of function pointers. Block commands
+ * execute the commands in their block the same way. A script file is parsed in
+ * full before any of it is executed.
  */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
-#include <errno.h>
 #include <math.h>
 #include <strings.h>
-
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/inotify.h>
+
+#include "analyze.h"
+#include "backend.h"
+#include "cache.h"
+#include "cull.h"
 #include "eval.h"
+#include "gstate.h"
+#include "image.h"
+#include "instance.h"
+#include "number.h"
+#include "parser.h"
+#include "pool.h"
+#include "svg.h"
+#include "writer.h"
 
 // The number of commands in the interpreter
-#define NUM_COMMANDS 17
+#define NUM_COMMANDS 28
 
 // Index that the PostScript commands begin at
-#define PS_CMD_START 5
+#define PS_CMD_START 7
+
+// Index that the style commands begin at. These are PS commands that don't
+// draw anything themselves, so they aren't wrapped in gsave/grestore.
+#define STYLE_CMD_START 25
+
+// The maximum number of parameters a macro may declare
+#define MAX_MACRO_PARAMS 16
+
+// A user-defined macro. The body is kept as parsed commands and compiled into
+// a PostScript procedure whenever a session is active.
+typedef struct Macro {
+    char* name;
+    int paramc;
+    char* params[MAX_MACRO_PARAMS];
+    Node* body;
+    // Whether the procedure changes the color, line width or dash
+    bool styled;
+    struct Macro* next;
+} Macro;
+
+// A tiling pattern that shapes may be filled with. The body is kept as parsed
+// commands and compiled into a pattern whenever a session is active.
+typedef struct Pattern {
+    char* name;
+    double width;
+    double height;
+    Node* body;
+    struct Pattern* next;
+} Pattern;
+
+// A font used in the current session, scaled once and kept under a short
+// name so that text doesn't look it up and scale it again
+typedef struct Font {
+    char* name;
+    double size;
+    int id;
+    struct Font* next;
+} Font;
+
+// The state of an SVG file being imported. With --relative, the points of
+// its paths are quantized, and lines written relative to the previous point
+// wherever that is shorter, as in drawPath.
+typedef struct Import {
+    bool relative;
+    // Whether the current point is known in steps of the precision, and the
+    // current point if it is
+    bool known;
+    int64_t lastX, lastY;
+    int shapes;
+} Import;
+
+// The arguments of a macro being expanded where it is invoked, for formats
+// without procedures. The parameters of the macro are bound to the values of
+// the arguments.
+typedef struct Binding {
+    Macro* macro;
+    double values[MAX_MACRO_PARAMS];
+    struct Binding* outer;
+} Binding;
 
 // Private function prototypes:
 
-// Evaluator for user input
-static void eval( FILE* inStream, bool psOnly );
-// Used to parse each command
-static int parseCommand( char* line, int* argc, char* argv[] );
+// Prints the program info
+static void printInfo( void );
+// Executes parsed commands
+static void execute( Node* node, bool inBlock );
+static void executeBlock( Node* body );
+static void executeBody( Node* body );
+// Helpers for generating shapes on worker threads
+static bool independent( Node* node );
+static void startPool( void );
+static void stopPool( void );
+static void generateShape( void* arg, Writer* out );
+// Helpers for watching scripts
+static void watchScript( char* filename );
+static void runScript( char* filename );
+static void generate( Node* node );
+static char* shapeKey( Node* node, size_t* length );
+static void describe( Writer* key, Node* node );
+static void describeState( Writer* key, const GState* state );
+static void forgetMacros( void );
+static void forgetPatterns( void );
+static void forgetFonts( void );
+// Helpers for flattening loops and rotations
+static bool flattening( void );
+static void transform( double* x, double* y );
+static void materialize( void );
+static size_t flatSize( Node* body );
+// Helpers for drawing shapes as instances of procedures
+static bool instancing( void );
+static bool drawInstance( const int64_t* points, int count, bool curve );
+// Helpers for writing blocks as forms
+static int findCommand( const char* name );
+static void (*findState( const char* name ))(Node* node);
+static bool blockBounds( Node* body, double box[4], double* width );
+static void addBounds( double box[4], double x, double y, double r );
+// Helpers for patterns
+static Pattern* findPattern( const char* name );
+static void compilePattern( Pattern* tile );
+// Helpers for text
+static Font* findFont( const char* name, double size );
+static void defineFonts( Node* node );
+static void writeString( const char* string );
+// Used to check names that are written as part of PostScript names
+static bool psName( const char* name );
+// Helpers for user-defined macros
+static Macro* findMacro( const char* name );
+static void compileMacro( Macro* macro );
+static void invokeMacro( Macro* macro, Node* node );
+static void expandMacro( Macro* macro, const double* values );
+static const char* paramRef( const char* arg );
+static bool boundArg( const char* arg, double* value );
+// Helpers for numeric arguments
+static bool numArg( const char* arg, double* value );
+static Arg makeArg( const char* arg, double value );
+static void writeArg( const char* arg, double value );
+static void writeNumber( double value );
+static void writeUnits( int64_t units );
+static void writeLine( int64_t x, int64_t y, int64_t* lastX, int64_t* lastY );
+static void writeCurve( const int64_t points[6], int64_t* lastX, int64_t* lastY );
+static size_t unitsLength( int64_t units );
+// Used to stream sessions to stdout or another descriptor
+static int claimStream( void );
+static bool streamsToStdout( const Node* nodes );
+// Used to write top-level shapes and paint them
+static void beginShape( void );
+static void endShape( void );
+static void paint( bool solid, const char* fill );
+// Shared implementations of the shape commands
+static void drawPath( Node* node, bool closed, bool solid, bool curve, const char* fill );
+static void drawCircle( Node* node, bool solid, const char* fill );
+static void drawPolygon( Node* node, bool solid, const char* fill );
+static Pattern* patternArg( Node* node, int argc, const char* usage, char** argv, Node* shape );
+static bool openImage( Node* node, double rect[4], Image* picture );
+static void drawImage( const double rect[4], Image* picture );
+
+// Draws the shapes of an imported SVG file
+static void importBegin( void* context );
+static void importMove( void* context, double x, double y );
+static void importLine( void* context, double x, double y );
+static void importCurve( void* context, const double points[6] );
+static void importClose( void* context );
+static void importPaint( void* context, bool filled );
+static void importCircle( void* context, double x, double y, double r, bool filled );
+static void importPoint( Import* state, double x, double y );
 
 // Functions for each command/state:
-static void path( int argc, char* argv[] );
-static void closedPath( int argc, char* argv[] );
-static void solidPath( int argc, char* argv[] );
-static void curve( int argc, char* argv[] );
-static void closedCurve( int argc, char* argv[] );
-static void solidCurve( int argc, char* argv[] );
-static void circle( int argc, char* argv[] );
-static void solidCircle( int argc, char* argv[] );
-static void polygon( int argc, char* argv[] );
-static void solidPolygon( int argc, char* argv[] );
-static void rotate( int argc, char* argv[] );
-static void begin( int argc, char* argv[] );
-static void end( int argc, char* argv[] );
-static void loop( int argc, char* argv[] );
-static void open( int argc, char* argv[] );
-static void quit( int argc, char* argv[] );
-static void help( int argc, char* argv[] );
+static void path( Node* node );
+static void closedPath( Node* node );
+static void solidPath( Node* node );
+static void curve( Node* node );
+static void closedCurve( Node* node );
+static void solidCurve( Node* node );
+static void circle( Node* node );
+static void solidCircle( Node* node );
+static void polygon( Node* node );
+static void solidPolygon( Node* node );
+static void patternPath( Node* node );
+static void patternCircle( Node* node );
+static void patternPolygon( Node* node );
+static void image( Node* node );
+static void text( Node* node );
+static void import( Node* node );
+static void rotate( Node* node );
+static void begin( Node* node );
+static void end( Node* node );
+static void loop( Node* node );
+static void color( Node* node );
+static void lineWidth( Node* node );
+static void dash( Node* node );
+static void openScript( Node* node );
+static void define( Node* node );
+static void definePattern( Node* node );
+static void quit( Node* node );
+static void help( Node* node );
 
 // List of states for the interpreter
-static void (*states[NUM_COMMANDS])(int argc, char* argv[]) =
+static void (*states[NUM_COMMANDS])(Node* node) =
         {
             help,
             begin,
             end,
             quit,
-            open,
+            openScript,
+            define,
+            definePattern,
             path,
             closedPath,
             solidPath,
@@ -71,8 +244,17 @@ static void (*states[NUM_COMMANDS])(int argc, char* argv[]) =
             solidCircle,
             polygon,
             solidPolygon,
+            patternPath,
+            patternCircle,
+            patternPolygon,
+            image,
+            text,
+            import,
             rotate,
-            loop
+            loop,
+            color,
+            lineWidth,
+            dash
         };
 
 // List of supported commands. These have a 1-to-1 mapping to the states above.
@@ -83,6 +265,8 @@ static char* commands[NUM_COMMANDS] =
             "end",
             "quit",
             "open",
+            "define",
+            "pattern",
             "path",
             "closedpath",
             "solidpath",
@@ -93,690 +277,2574 @@ static char* commands[NUM_COMMANDS] =
             "solidcircle",
             "polygon",
             "solidpolygon",
+            "patternpath",
+            "patterncircle",
+            "patternpolygon",
+            "image",
+            "text",
+            "import",
             "rotate",
-            "loop"
+            "loop",
+            "color",
+            "linewidth",
+            "dash"
         };
 
-// The PostScript file currently being operated on
-static FILE* session = NULL;
+// The PostScript file currently being operated on. Worker threads generating
+// shapes each write to their own, which is why this and the other state shapes
+// use is per thread.
+static _Thread_local Writer* session = NULL;
+
+// The format sessions are written in
+static const Backend* backend = NULL;
+
+// When culling, the session is collected in memory, and this is the file the
+// page is written to once it is finished
+static Writer* page = NULL;
+
+// The options sessions are generated with
+static Options options;
+
+// The descriptor streamed sessions are written to, once it has been claimed
+static int streamFd = -1;
+
+// Whether the current session is being streamed
+static bool streaming = false;
+
+// The version printed in the program info, and whether it has been printed
+static const char* programVersion = "";
+static bool informed = false;
+
+// Whether the commands being executed were typed by the user
+static _Thread_local bool interactive = false;
+
+// All macros defined so far, most recent first
+static Macro* macros = NULL;
+
+// All patterns defined so far, most recent first
+static Pattern* patterns = NULL;
+
+// The macro whose body is currently being compiled, if any
+static _Thread_local Macro* compiling = NULL;
+
+// The innermost macro being expanded, for formats without procedures
+static _Thread_local Binding* binding = NULL;
+
+// The number of forms defined so far. A form is only defined if userdict
+// doesn't hold one of its name yet, and sessions streamed to the same
+// descriptor share userdict, so forms are numbered across every session.
+static int formCount = 0;
+
+// The fonts defined in the current session, most recent first
+static Font* fonts = NULL;
 
-// The input stream the interpreter will retrieve commands from
-static FILE* input = NULL;
+// Whether the commands being executed are the body of a form
+static _Thread_local bool inForm = false;
+
+// When generating shapes on worker threads, the pool generating them, and the
+// file their output is merged into. Meanwhile the session is collected in
+// memory, and merged in order with the shapes.
+static Pool* pool = NULL;
+static Writer* merged = NULL;
+
+// With --flatten, the rotation applied by the script that hasn't been written
+// to the file, in degrees. Coordinates are rotated by it as they are written.
+static _Thread_local double flatAngle = 0;
+
+// With --flatten, the number of loops being written as procedures, in which
+// rotations have to be written too
+static _Thread_local int procedural = 0;
+
+// The estimated size of the parts of a flattened command, in bytes, used to
+// decide whether a loop fits in the --flatten budget. Numbers are estimated
+// at three whole digits, a sign and a point.
+#define FLAT_COMMAND_BYTES 24
+#define FLAT_NUMBER_BYTES (getPrecision() + 5)
+#define FLAT_POINT_BYTES (2 * FLAT_NUMBER_BYTES + 8)
+
+// The fewest points a path must have to be drawn as an instance, below which
+// calling a procedure saves too little to be worth defining one
+#define INSTANCE_MIN_POINTS 3
+
+// When watching a script, whether the current run has quit
+static bool quitting = false;
+
+// How long to wait for a script to stop changing before running it again, in
+// milliseconds. Editors often save a file in several steps.
+#define WATCH_SETTLE_MS 50
+
+// The most consecutive shapes generated by one job. Shapes are small, so they
+// are batched to keep the cost of handing them to a worker down.
+#define JOB_SHAPES 64
+
+// Consecutive top-level shapes to generate on a worker thread, and the style
+// in effect when they start
+typedef struct ShapeJob {
+    Node* node;
+    int count;
+    GState pending;
+    GState current;
+} ShapeJob;
 
 /*
  * Main run loop of the interpreter.
  * Continues indefinitely, until the user quits the interpreter.
  *
  * Input:
- * char* filename - (optional) If filename of a script is provided when program
- *                             is executed, then open a evaluate the script.
+ * char* filename      - (optional) If filename of a script is provided when program
+ *                                  is executed, then open a evaluate the script.
+ * const char* version - The version printed in the program info.
+ * Options* options    - The options sessions are generated with.
  *
  * Returns:
  * None
  */
-void run( char* filename ) {
+void run( char* filename, const char* version, const Options* opts ) {
+    options = *opts;
+    backend = options.backend;
+    programVersion = version;
+
+    // Move the interpreter's output off of the stream before any is printed
+    if( options.outputFd >= 0 ) {
+        claimStream();
+    }
+
+    // A script is parsed before the program info is printed, so that it can
+    // be kept off of stdout if the script streams a session to it
+    if( filename == NULL ) {
+        printInfo();
+    }
+
+    char* quitArgs[1] = { "quit" };
+    Node quitNode = { .argc = 1, .argv = quitArgs };
+
     // Check if a script filename was provided
     if( filename == NULL ) {
+        Parser parser;
+        parserInit( &parser, stdin, "stdin", true );
+
         // Continue reading user input until the user quits
         while(1) {
             // Print interpreter promt
             printf( "\n>> " );
+            fflush(stdout);
 
             // Get and evaluate user input
-            eval( stdin, false );
+            bool eof;
+            Node* node = parseNext( &parser, &eof );
+            if(eof) {
+                break;
+            }
+            if( node != NULL ) {
+                interactive = true;
+                execute( node, false );
+                freeNodes(node);
+            }
         }
+    } else if( options.watch ) {
+        // Run the script whenever it changes
+        watchScript( filename );
     } else {
         // Set up args
         char* argv[2] = { "open", filename };
+        Node node = { .argc = 2, .argv = argv };
         // Execute script file
-        open( 2, argv );
+        openScript( &node );
+    }
 
-        // Quit the interpreter
-        char* argv2[2] = { "quit", "1" };
-        quit( 2, argv2 );
+    // Quit the interpreter
+    quit( &quitNode );
+}
+
+/*
+ * Prints the name and version of the program, the first time it is called.
+ */
+void printInfo( void ) {
+    if(informed) {
+        return;
     }
+
+    informed = true;
+    printf( "PostGen - PostScript Generator\n" );
+    printf( "Version: %s\n", programVersion );
+    printf( "Enter a command, or 'help' to view available commands.\n" );
 }
 
 /*
- * Reads and evaluates user input.
+ * Executes a parsed command.
  *
  * Input:
- * FILE* input - Set the input stream.
- * bool psOnly - Set if only PS commands should be recognized, or all commands.
+ * Node* node   - The command to execute.
+ * bool inBlock - Set if the command is within a block, where only PS commands
+ *                are allowed.
  *
  * Returns:
  * None
  */
-void eval( FILE* inStream, bool psOnly ) {
-    // Check that a valid input stream was provided
-    if( inStream == NULL ) {
-        printf( "\nERROR:\tInvalid input stream specified!\n" );
-        return;
-    } else {
-        // Set the input stream
-        input = inStream;
-    }
-
-    // Used by parseCommand
-    int argc = 0;
-    char* argv[30];
-
-    // Get command from user
-    char line[255];
-    // Only proccess command if we successfully read something
-    if( fgets( line, 255, input ) != NULL ) {
-        // Parse the user command
-        int parseErr = parseCommand( line, &argc, argv );
-
-        // If a command was provided, try to execute it
-        if( argc > 0 ) {
-            // Used to detect if the command was unknown
-            bool found = false;
-            // Check if the command given is a known command
-            // Only execute if parseCommand succeeded
-            int start = 0;
-            if(psOnly) { start = PS_CMD_START; }
-            for( int i = start; i < NUM_COMMANDS && parseErr == 0; i++  ) {
-                if( strcmp( commands[i], argv[0] ) == 0 ) {
-                    // Ensure there is an active session prior to executing
-                    // commands that require it.
-                    if( session == NULL && i >= PS_CMD_START ) {
-                        printf( "\nERROR:\tNo active session!\n" );
-                        return;
-                    }
-
-                    // If we are executing a PS command, add this to file
-                    if( i >= PS_CMD_START && !psOnly ) {
-                        // Save coordinate system state
-                        fprintf( session, "gsave\n" );
-                    }
-
-                    // Execute the command with provided args
-                    (*states[i])(argc, argv);
+void execute( Node* node, bool inBlock ) {
+    char* name = node->argv[0];
+
+    // With --analyze, what the command draws is attributed to its line
+    analyzeLine( node->line );
+
+    // Check if the command given is a known command
+    for( int i = 0; i < NUM_COMMANDS; i++ ) {
+        if( strcmp( commands[i], name ) == 0 ) {
+            // Only PS commands may be used within a block
+            if( inBlock && i < PS_CMD_START ) {
+                printf( "\nERROR:\t'%s' cannot be used within a block!\n", name );
+                return;
+            }
 
-                    // If we are executing a PS command, add this to file
-                    if( i >= PS_CMD_START && !psOnly ) {
-                        // Restore state
-                        fprintf( session, "grestore\n" );
-                    }
+            // Ensure there is an active session prior to executing
+            // commands that require it.
+            if( session == NULL && i >= PS_CMD_START ) {
+                printf( "\nERROR:\tNo active session!\n" );
+                return;
+            }
 
-                    // We found a valid command
-                    found = true;
+            // If we are executing a PS command, add this to file
+            bool shape = i >= PS_CMD_START && i < STYLE_CMD_START;
+
+            // An image is opened before its shape is started, so that a file
+            // that can't be drawn doesn't leave an empty shape behind
+            if( states[i] == image && !inBlock ) {
+                Image picture;
+                double rect[4];
+                if( openImage( node, rect, &picture ) ) {
+                    beginShape();
+                    drawImage( rect, &picture );
+                    endShape();
                 }
+                return;
             }
 
-            // Free the args list
-            for( int i = 0; i < argc; i++ ) {
-                free(argv[i]);
+            if( shape && !inBlock ) {
+                // Fonts are defined before the shape, so that they outlast it
+                defineFonts( node );
+
+                // Save coordinate system state
+                beginShape();
             }
 
-            // If an invalid command was provided, display error
-            if(!found) {
-                printf( "\nERROR: Unknown command!\n" );
+            // Execute the command
+            (*states[i])(node);
+
+            // If we are executing a PS command, add this to file
+            if( shape && !inBlock ) {
+                // Restore state
+                endShape();
             }
-        } else {
-            // We weren't given a command. This should never happen.
-            printf( "\nERROR: No command provided!\n" );
+            return;
+        }
+    }
+
+    // Otherwise, check if the command invokes a user-defined macro
+    Macro* macro = findMacro( name );
+    if( macro != NULL ) {
+        if( session == NULL ) {
+            printf( "\nERROR:\tNo active session!\n" );
+            return;
         }
+
+        // Macros are PS commands, so treat them the same way
+        if( !inBlock ) {
+            beginShape();
+        }
+        invokeMacro( macro, node );
+        if( !inBlock ) {
+            endShape();
+        }
+        return;
     }
+
+    // An invalid command was provided, display error
+    printf( "\nERROR: Unknown command '%s'!\n", name );
 }
 
 /*
- * Parses the command provided by the user to the interpreter.
- * NOTE: This function mallocs each element of the args list individually.
- *       It is the responsibility of the caller to free each element manually.
+ * Executes the commands in a block, in order.
  *
  * Input:
- * char* line   - The line of input to be parsed.
- * int* argc    - Used to return the count of args found.
- * char* argv[] - Used to return the args found.
+ * Node* body - The first command in the block.
  */
-int parseCommand( char* line, int* argc, char* argv[] ) {
-    // Get the first argument
-    char* current = strtok( line, " \n" );
-    // Continue until there are no arguments left to read
-    while( current != NULL ) {
-        // Set the current argument in the args list
-        argv[*argc] = (char*)malloc(strlen(current) + 1);
-        if( argv[*argc] == NULL ) {
-            printf( "\nERROR:\tUnable to allocate args list!\n" );
-            return -1;
-        }
-        strcpy( argv[*argc], current );
-        // Increment args count
-        (*argc)++;
-        // Get the next argument
-        current = strtok( NULL, " \n" );
+void executeBlock( Node* body ) {
+    for( Node* node = body; node != NULL; node = node->next ) {
+        execute( node, true );
     }
-
-    return 0;
 }
 
 /*
- * Command state for drawing a user-defined path.
+ * Checks if a command can be generated on a worker thread. It must be a shape
+ * whose output only depends on the style in effect when it starts, and that
+ * doesn't change anything that later commands depend on.
  *
  * Input:
- * int x, y   - Starting point for the path.
- * int closed - (optional) Whether the generated path will be closed or open.
- * int solid  - (optional) Whether the generated path should be filled or not.
- * int curve  - (optional) Whether the generated path is based on curves or lines.
+ * Node* node - The command.
+ *
+ * Returns:
+ * True if the command can be generated on a worker thread.
  */
-void path( int argc, char* argv[] ) {
-    // Check if we have the correct number of arguments
-    if( argc < 3 || argc > 6 ) {
-        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\tpath <start_x> <start_y>\n" );
-    } else {
-        if( session == NULL ) {
-            printf( "\nERROR:\tNo active session!\n" );
-            return;
-        }
+bool independent( Node* node ) {
+    int i = findCommand( node->argv[0] );
 
-        printf( "\nEnter a series of points (one tuple per line), and 'done' when finished:\n" );
-
-        // Get the starting point of the path
-        int startX = atoi( argv[1] );
-        int startY = atoi( argv[2] );
-
-        // Get path options if provided
-        int closed = 0;
-        int solid  = 0;
-        int curve  = 0;
-        if( argc >= 4 ) {
-            // If this path should be closed or open
-            closed = atoi(argv[3]);
-            if( argc >= 5 ) {
-                // If this path should be filled or stroked
-                solid = atoi(argv[4]);
-                if( argc == 6 ) {
-                    // If this path should use curves or lines
-                    curve = atoi(argv[5]);
-                }
-            }
-        }
+    // Control commands and macros are executed in order, and style commands
+    // change the style of later shapes
+    if( i < PS_CMD_START || i >= STYLE_CMD_START ) {
+        return false;
+    }
 
-        // Begin the path in the file
-        fprintf( session, "newpath\n" );
-        fprintf( session, "%d %d moveto\n", startX, startY );
+    // Images and imports are streamed from their files, which may change
+    // between runs, and fonts are numbered in order
+    if( states[i] == image || states[i] == import || states[i] == text ) {
+        return false;
+    }
 
-        // Current cound of points entered
-        int points = 0;
+    // Forms are numbered in order
+    if( options.forms && (states[i] == loop || states[i] == rotate) ) {
+        return false;
+    }
 
-        // Continue reading points until the user is finished
-        while(1) {
-            // Print state prompt
-            printf(": ");
-
-            char point[255];
-            if( fgets( point, 255, input ) != NULL ) {
-                // Get the first argument
-                char* first = strtok( point, " \n" );
-
-                // If the argument is 'done', exit this state
-                if( strcmp( first, "done" ) == 0 ) {
-                    // Apply points as curves if option is set
-                    if(curve) {
-                        // Three points are required for a valid curve
-                        if( points < 3 ) {
-                            printf( "ERROR:\t Need at least %d more points to create a valid curve!\n", (3 - points) );
-                            continue;
-                        }
-                        fprintf( session, "curveto\n" );
-                    }
+    for( Node* child = node->body; child != NULL; child = child->next ) {
+        if( !independent( child ) ) {
+            return false;
+        }
+    }
 
-                    // Close the path if option is set
-                    if(closed) {
-                        fprintf( session, "closepath\n" );
-                    }
+    return true;
+}
 
-                    // Apply the appropriate path finalizer
-                    if(solid) {
-                        fprintf( session, "fill\n" );
-                    } else {
-                        fprintf( session, "stroke\n" );
-                    }
+/*
+ * Starts generating shapes on worker threads, if it hasn't already started.
+ * If the workers can't be started, shapes are generated here instead.
+ */
+void startPool( void ) {
+    if( pool != NULL ) {
+        return;
+    }
 
-                    // End path construction
-                    break;
-                } else {
-                    // Retreive the arguments
-                    char* xC = first;
-                    char* yC = strtok( NULL, " \n" );
-
-                    // Ensure that both arguments were provided
-                    if( xC != NULL && yC != NULL ) {
-                        // Reset errno to 0 to check for error on the following calls
-                        errno = 0;
-
-                        // Convert the provided strings to numbers
-                        int x = strtol( xC, NULL, 10 );
-                        int y = strtol( yC, NULL, 10 );
-
-                        // NOTE: The behavior of strtol setting errno when not provided
-                        // with a number is implementation specific. Thus, it is
-                        // possible to not receive an error when provided non-numeric
-                        // arguments. In such a case the argument with simply resolve
-                        // to 0.
-                        if( !errno ) {
-                            // Add the next point to the path
-                            fprintf( session, "%d %d", x, y );
-                            // Define points as lines if curve not set
-                            if(!curve) {
-                                fprintf( session, " lineto" );
-                            }
-                            fprintf( session, "\n" );
-
-                            // Increment the number of points
-                            points++;
-                        } else {
-                            printf( "ERROR:\tArguments must be numbers!\n" );
-                        }
-                    } else {
-                        printf( "ERROR:\tInvalid number of arguments provided!\n" );
-                        printf( "Usage:\t<x> <y>\n");
-                    }
-                }
-            }
-        }
-        printf( "Path finished.\n" );
+    Writer* serial = writerOpenMemory();
+    if( serial == NULL ) {
+        return;
     }
+    pool = poolOpen( options.jobs, session );
+    if( pool == NULL ) {
+        writerClose(serial);
+        return;
+    }
+
+    merged = session;
+    session = serial;
 }
 
 /*
- * Command state for drawing a user-defined closed path.
- *
- * Input:
- * int x, y - Starting point for the path.
+ * Waits for the shapes being generated on worker threads, and merges them
+ * into the session, so that it can be written to directly again.
  */
-void closedPath( int argc, char* argv[] ) {
-    // Check if we have the correct number of arguments
-    if( argc != 3 ) {
-        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\tclosedpath <start_x> <start_y>\n" );
-    } else {
-        // Alloc space
-        argv[3] = (char*)malloc(sizeof(char) + 1);
-        memset( argv[3], 0, sizeof(char) + 1);
-
-        // Make sure the alloc succeeded
-        if( argv[3] != NULL ) {
-            // Set the args for a solid path
-            argv[3][0] = '1';
-            argc++;
-
-            // Call path with new args added
-            path(argc, argv);
-        } else {
-            printf( "\nERROR:\tFailed to allocate args list!\n" );
-            return;
-        }
+void stopPool( void ) {
+    if( pool == NULL ) {
+        return;
+    }
 
-        // Free the extra args we added
-        free(argv[3]);
+    poolWrite( pool, session );
+    poolClose(pool);
+    writerClose(session);
+    session = merged;
+    pool = NULL;
+    merged = NULL;
+
+    if(streaming) {
+        writerFlush(session);
     }
 }
 
 /*
- * Command state for drawing a user-defined solid path.
+ * Generates consecutive top-level shapes on a worker thread.
  *
  * Input:
- * int x, y - Starting point for the path.
+ * void* arg   - The shapes to generate.
+ * Writer* out - Where to write the shapes.
  */
-void solidPath( int argc, char* argv[] ) {
-    // Check if we have the correct number of arguments
-    if( argc != 3 ) {
-        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\tsolidpath <start_x> <start_y>\n" );
-    } else {
-        // Alloc space
-        argv[3] = (char*)malloc(sizeof(char) + 1);
-        argv[4] = (char*)malloc(sizeof(char) + 1);
-        memset( argv[3], 0, sizeof(char) + 1);
-        memset( argv[4], 0, sizeof(char) + 1);
-
-        // Make sure the alloc succeeded
-        if( argv[3] != NULL && argv[4] != NULL ) {
-            // Set the args for a solid path
-            argv[3][0] = '1';
-            argv[4][0] = '1';
-            argc += 2;
-
-            // Call path with new args added
-            path(argc, argv);
-        } else {
-            printf( "\nERROR:\tFailed to allocate args list!\n" );
-            return;
-        }
-
-        // Free the extra args we added
-        free(argv[3]);
-        free(argv[4]);
+void generateShape( void* arg, Writer* out ) {
+    ShapeJob* job = (ShapeJob*)arg;
+
+    session = out;
+    gstateLoad( &job->pending, &job->current );
+    Node* node = job->node;
+    for( int i = 0; i < job->count; i++, node = node->next ) {
+        generate( node );
     }
+    session = NULL;
+
+    free(job);
 }
 
 /*
- * Command state for drawing a user-defined bezier curve.
+ * Runs a script, and then runs it again whenever it changes. Only the shapes
+ * that changed are generated again, the output of the rest is reused. Runs
+ * until the interpreter is interrupted.
  *
  * Input:
- * int x, y - Starting point for the path.
+ * char* filename - Name of the script file to watch.
  */
-void curve( int argc, char* argv[] ) {
-    // Check if we have the correct number of arguments
-    if( argc != 3 ) {
-        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\tcurve <start_x> <start_y>\n" );
-    } else {
-        // Alloc space
-        argv[3] = (char*)malloc(sizeof(char) + 1);
-        argv[4] = (char*)malloc(sizeof(char) + 1);
-        argv[5] = (char*)malloc(sizeof(char) + 1);
-        memset( argv[3], 0, sizeof(char) + 1);
-        memset( argv[4], 0, sizeof(char) + 1);
-        memset( argv[5], 0, sizeof(char) + 1);
-
-
-        // Make sure the alloc succeeded
-        if( argv[3] != NULL && argv[4] != NULL && argv[5] != NULL ) {
-            // Set the args for a solid path
-            argv[3][0] = '0';
-            argv[4][0] = '0';
-            argv[5][0] = '1';
-            argc += 3;
-
-            // Call path with new args added
-            path(argc, argv);
-        } else {
-            printf( "\nERROR:\tFailed to allocate args list!\n" );
-            return;
-        }
+void watchScript( char* filename ) {
+    // Editors often replace a file rather than writing to it, so watch the
+    // directory it is in for a file of its name
+    char* directoryCopy = strdup( filename );
+    char* nameCopy = strdup( filename );
+    int watch = inotify_init1( IN_CLOEXEC );
+    if( directoryCopy == NULL || nameCopy == NULL || watch < 0
+        || inotify_add_watch( watch, dirname( directoryCopy ), IN_CLOSE_WRITE | IN_MOVED_TO ) < 0 ) {
+        printf( "\nERROR:\tFailed to watch script file: %s\n", strerror(errno) );
+        free(directoryCopy);
+        free(nameCopy);
+        return;
+    }
+    const char* name = basename( nameCopy );
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(1) {
+        runScript( filename );
+        printf( "Watching %s for changes...\n", filename );
+        fflush(stdout);
+
+        // Wait for the script to change, and then for it to settle
+        bool changed = false;
+        struct pollfd ready = { .fd = watch, .events = POLLIN };
+        while( !changed || poll( &ready, 1, WATCH_SETTLE_MS ) > 0 ) {
+            ssize_t length = read( watch, events, sizeof(events) );
+            if( length < 0 ) {
+                if( errno == EINTR ) {
+                    continue;
+                }
+                printf( "\nERROR:\tFailed to watch script file: %s\n", strerror(errno) );
+                free(directoryCopy);
+                free(nameCopy);
+                close(watch);
+                return;
+            }
 
-        // Free the extra args we added
-        free(argv[3]);
-        free(argv[4]);
-        free(argv[5]);
+            for( char* at = events; at < events + length; ) {
+                struct inotify_event* event = (struct inotify_event*)at;
+                if( event->len > 0 && strcmp( event->name, name ) == 0 ) {
+                    changed = true;
+                }
+                at += sizeof(struct inotify_event) + event->len;
+            }
+        }
     }
 }
 
 /*
- * Command state for drawing a user-defined, closed bezier curve.
+ * Runs a watched script, reusing the output of the shapes that haven't
+ * changed since the last run, and reports how long it took.
  *
  * Input:
- * int x, y - Starting point for the path.
+ * char* filename - Name of the script file to run.
  */
-void closedCurve( int argc, char* argv[] ) {
-    // Check if we have the correct number of arguments
-    if( argc != 3 ) {
-        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\tclosedcurve <start_x> <start_y>\n" );
-    } else {
-        // Alloc space
-        argv[3] = (char*)malloc(sizeof(char) + 1);
-        argv[4] = (char*)malloc(sizeof(char) + 1);
-        argv[5] = (char*)malloc(sizeof(char) + 1);
-        memset( argv[3], 0, sizeof(char) + 1);
-        memset( argv[4], 0, sizeof(char) + 1);
-        memset( argv[5], 0, sizeof(char) + 1);
-
-        // Make sure the alloc succeeded
-        if( argv[3] != NULL && argv[4] != NULL && argv[5] != NULL ) {
-            // Set the args for a solid path
-            argv[3][0] = '1';
-            argv[4][0] = '0';
-            argv[5][0] = '1';
-            argc += 3;
-
-            // Call path with new args added
-            path(argc, argv);
-        } else {
-            printf( "\nERROR:\tFailed to allocate args list!\n" );
-            return;
-        }
-
-        // Free the extra args we added
-        free(argv[3]);
-        free(argv[4]);
-        free(argv[5]);
+void runScript( char* filename ) {
+    struct timespec start;
+    struct timespec finish;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    // Each run starts over, apart from the output of shapes
+    quitting = false;
+    forgetMacros();
+    forgetPatterns();
+    cacheBegin();
+
+    char* argv[2] = { "open", filename };
+    Node node = { .argc = 2, .argv = argv };
+    openScript( &node );
+
+    // Finish the file, even if the script doesn't
+    if( session != NULL ) {
+        char* endArgs[1] = { "end" };
+        Node endNode = { .argc = 1, .argv = endArgs };
+        end( &endNode );
     }
+
+    CacheStats stats;
+    cacheSweep( &stats );
+    clock_gettime( CLOCK_MONOTONIC, &finish );
+    double elapsed = (finish.tv_sec - start.tv_sec) * 1e3 + (finish.tv_nsec - start.tv_nsec) / 1e6;
+    printf( "\nRan %s in %.1f ms (%d shapes reused, %d generated).\n", filename, elapsed,
+            stats.reused, stats.generated );
 }
 
 /*
- * Command state for drawing a user-defined, filled bezier curve.
+ * Executes a top-level shape. When watching a script, its output is reused
+ * if it was generated before in the same state, and otherwise kept for the
+ * next run.
  *
  * Input:
- * int x, y - Starting point for the path.
+ * Node* node - The shape.
  */
-void solidCurve( int argc, char* argv[] ) {
-    // Check if we have the correct number of arguments
-    if( argc != 3 ) {
-        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\tcurve <start_x> <start_y>\n" );
-    } else {
-        // Alloc space
-        argv[3] = (char*)malloc(sizeof(char) + 1);
-        argv[4] = (char*)malloc(sizeof(char) + 1);
-        argv[5] = (char*)malloc(sizeof(char) + 1);
-        memset( argv[3], 0, sizeof(char) + 1);
-        memset( argv[4], 0, sizeof(char) + 1);
-        memset( argv[5], 0, sizeof(char) + 1);
-
-        // Make sure the alloc succeeded
-        if( argv[3] != NULL && argv[4] != NULL && argv[5] != NULL ) {
-            // Set the args for a solid path
-            argv[3][0] = '1';
-            argv[4][0] = '1';
-            argv[5][0] = '1';
-            argc += 3;
-
-            // Call path with new args added
-            path(argc, argv);
-        } else {
-            printf( "\nERROR:\tFailed to allocate args list!\n" );
-            return;
+void generate( Node* node ) {
+    if( !options.watch ) {
+        execute( node, false );
+        return;
+    }
+
+    // The style is written before the shape, as in beginShape, so that the
+    // output only depends on the state it starts in
+    backend->sync( session, GS_ALL );
+
+    size_t keyLength;
+    char* key = shapeKey( node, &keyLength );
+    if( key != NULL && cacheFind( key, keyLength, session ) ) {
+        free(key);
+        return;
+    }
+
+    Writer* out = session;
+    Writer* shape = key != NULL ? writerOpenMemory() : NULL;
+    if( shape == NULL ) {
+        free(key);
+        execute( node, false );
+        return;
+    }
+
+    session = shape;
+    execute( node, false );
+    session = out;
+
+    size_t length;
+    char* data = writerTake( shape, &length );
+    if( data != NULL ) {
+        writerWrite( out, data, length );
+        if( writerError( shape ) == 0 ) {
+            cacheStore( key, keyLength, data, length );
+            key = NULL;
         }
+    }
+    writerClose(shape);
+    free(data);
+    free(key);
 
-        // Free the extra args we added
-        free(argv[3]);
-        free(argv[4]);
-        free(argv[5]);
+    if(streaming) {
+        writerFlush(out);
     }
 }
 
 /*
- * Command state for drawing a circle at center (x,y) and a given radius.
+ * Describes a top-level shape and the state it is generated in, such that
+ * two shapes with the same description generate the same output.
  *
  * Input:
- * int x, y - The center coordinates of the circle.
- * int r    - The radius of the circle.
+ * Node* node     - The shape.
+ * size_t* length - Set to the length of the description.
+ *
+ * Returns:
+ * The description, or NULL if there isn't enough memory.
  */
-void circle( int argc, char* argv[] ) {
-    // Check if we have the correct number of arguments
-    if( argc != 4 ) {
-        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\tcircle <center_x> <center_y> <radius>\n" );
-    } else {
-        if( session == NULL ) {
-            printf( "\nERROR:\tNo active session!\n" );
-            return;
-        }
+char* shapeKey( Node* node, size_t* length ) {
+    Writer* key = writerOpenMemory();
+    if( key == NULL ) {
+        return NULL;
+    }
 
-        // Get the argument values
-        int x = atoi(argv[1]);
-        int y = atoi(argv[2]);
-        int r = atoi(argv[3]);
+    Node* next = node->next;
+    node->next = NULL;
+    describe( key, node );
+    node->next = next;
 
-        // Create the circle
-        fprintf( session, "%d %d %d 0 360 arc\n", x, y, r );
-        fprintf( session, "stroke\n");
-    }
+    GState current = gstateCurrent();
+    describeState( key, gstatePending() );
+    describeState( key, &current );
+
+    char* data = writerError( key ) == 0 ? writerTake( key, length ) : NULL;
+    writerClose(key);
+    return data;
 }
 
 /*
- * Command state for drawing a filled circle at center (x,y) and a given radius.
+ * Describes a list of commands, and their points and blocks.
  *
  * Input:
- * int x, y - The center coordinates of the circle.
- * int r    - The radius of the circle.
+ * Writer* key - Where to write the description.
+ * Node* node  - The first command.
  */
-void solidCircle( int argc, char* argv[] ) {
-    // Check if we have the correct number of arguments
-    if( argc != 4 ) {
-        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\tcircle <center_x> <center_y> <radius>\n" );
-    } else {
-        if( session == NULL ) {
-            printf( "\nERROR:\tNo active session!\n" );
-            return;
+void describe( Writer* key, Node* node ) {
+    for( ; node != NULL; node = node->next ) {
+        // Each word keeps its terminator, so words can't run together
+        for( int i = 0; i < node->argc; i++ ) {
+            writerWrite( key, node->argv[i], strlen( node->argv[i] ) + 1 );
         }
-
-        // Get the argument values
-        int x = atoi(argv[1]);
-        int y = atoi(argv[2]);
-        int r = atoi(argv[3]);
-
-        // Create the circle
-        fprintf( session, "%d %d %d 0 360 arc\n", x, y, r );
-        fprintf( session, "fill\n");
+        writerWrite( key, "(", 1 );
+        for( int i = 0; i < node->pointc; i++ ) {
+            writerWrite( key, node->points[i], strlen( node->points[i] ) + 1 );
+        }
+        writerWrite( key, "{", 1 );
+        describe( key, node->body );
+        writerWrite( key, "}", 1 );
     }
 }
 
 /*
- * Command state for drawing an n-sided polygon.
+ * Describes the known parts of a graphics state.
  *
  * Input:
- * int x, y  - The center coordinates of the polygon.
- * int r     - The radius of the polygon.
- * int n     - The number of sides of the polygon.
- * int solid - (optional) Whether the polygon should be filled or not.
+ * Writer* key          - Where to write the description.
+ * const GState* state  - The state.
  */
-void polygon( int argc, char* argv[] ) {
-    // Check if we have the correct number of arguments
-    if( argc < 5 || argc > 6 ) {
-        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\tpolygon <center_x> <center_y> <radius> <sides>\n" );
-    } else {
-        if( session == NULL ) {
-            printf( "\nERROR:\tNo active session!\n" );
-            return;
-        }
-
-        // Get the argument values
-        float x = atof(argv[1]);
-        float y = atof(argv[2]);
-        float r = atof(argv[3]);
-        float n = atof(argv[4]);
+void describeState( Writer* key, const GState* state ) {
+    writerWrite( key, (const char*)&state->known, sizeof(state->known) );
+    if( state->known & GS_COLOR ) {
+        writerWrite( key, (const char*)state->color, sizeof(state->color) );
+    }
+    if( state->known & GS_LINE_WIDTH ) {
+        writerWrite( key, (const char*)&state->lineWidth, sizeof(state->lineWidth) );
+    }
+    if( state->known & GS_DASH ) {
+        writerWrite( key, (const char*)&state->dashCount, sizeof(state->dashCount) );
+        writerWrite( key, (const char*)state->dash, state->dashCount * sizeof(double) );
+    }
+}
 
-        // Get the solid setting arg
-        int solid = 0;
-        if( argc == 6 ) {
-            solid = atoi(argv[5]);
+/*
+ * Forgets every macro, so that a script that is run again only has the
+ * macros it defines.
+ */
+void forgetMacros( void ) {
+    while( macros != NULL ) {
+        Macro* macro = macros;
+        macros = macro->next;
+        for( int i = 0; i < macro->paramc; i++ ) {
+            free( macro->params[i] );
         }
+        freeNodes( macro->body );
+        free( macro->name );
+        free(macro);
+    }
+}
 
-        // Calculate the all the points for the polygon
-        for( int i = 0; i < n; i++ ) {
-            // Get the x,y for the next point
-            float curX = r * cos( 2.0 * M_PI * (i/n) ) + x;
-            float curY = r * sin( 2.0 * M_PI * (i/n) ) + y;
-
-            // Write the current point
-            fprintf( session, "%f %f", curX, curY );
-            if( i == 0 ) {
-                // If this is the first point move into position
-                fprintf( session, " moveto\n");
-            } else {
-                // Set lines for all other points
-                fprintf( session, " lineto\n" );
-            }
-        }
+/*
+ * Forgets every pattern, so that a script that is run again only has the
+ * patterns it defines.
+ */
+void forgetPatterns( void ) {
+    while( patterns != NULL ) {
+        Pattern* tile = patterns;
+        patterns = tile->next;
+        freeNodes( tile->body );
+        free( tile->name );
+        free(tile);
+    }
+}
 
-        // Close the path to complete the polygon
-        fprintf( session, "closepath\n" );
+/*
+ * Forgets the fonts defined in the session, for a new session.
+ */
+void forgetFonts( void ) {
+    while( fonts != NULL ) {
+        Font* font = fonts;
+        fonts = font->next;
+        free( font->name );
+        free(font);
+    }
+}
 
-        // Draw the polygon
-        if(solid) {
-            fprintf( session, "fill\n" );
-        } else {
-            fprintf( session, "stroke\n" );
-        }
+/*
+ * Executes the body of a loop or rotate block. With --forms, a body that draws
+ * the same thing every time it runs is written as a form instead: it is
+ * defined the first time it runs, and invoked with execform, so that RIPs that
+ * cache forms only rasterize it once.
+ *
+ * A body that leaves the coordinate system changed, or that invokes macros,
+ * is written inline, as are blocks nested in a form or in a macro.
+ *
+ * Input:
+ * Node* body - The first command in the block.
+ */
+void executeBody( Node* body ) {
+    double box[4];
+    double width;
+    if( !options.forms || inForm || compiling != NULL || !blockBounds( body, box, &width ) ) {
+        executeBlock( body );
+        return;
     }
+
+    // Strokes may extend past the path by up to half the miter limit
+    // (10 by default) times the line width, and hairlines by a pixel
+    double margin = width * 5 + 1;
+
+    // Define the form once, even when the block is itself repeated
+    int id = ++formCount;
+    writerPrintf( session, "userdict /f_%d known not {\n", id );
+    writerPrintf( session, "userdict /f_%d <<\n/FormType 1\n/BBox [", id );
+    writeNumber( box[0] - margin );
+    writerPrintf( session, " " );
+    writeNumber( box[1] - margin );
+    writerPrintf( session, " " );
+    writeNumber( box[2] + margin );
+    writerPrintf( session, " " );
+    writeNumber( box[3] + margin );
+    writerPrintf( session, "]\n/Matrix [1 0 0 1 0 0]\n/PaintProc { pop\n" );
+
+    // The form is painted in its own graphics state, and may be invoked in
+    // any style, so it sets every part of the style it uses
+    gstatePush();
+    gstateForget( GS_ALL );
+    inForm = true;
+    executeBlock( body );
+    inForm = false;
+    gstatePop();
+
+    writerPrintf( session, "} bind\n>> put\n} if\n" );
+    writerPrintf( session, "f_%d execform\n", id );
 }
 
-/* Command state for drawing a filled n-sided polygon.
+/*
+ * Checks if loops and rotations are being flattened: evaluated here, with the
+ * rotation applied to the coordinates that are written. They aren't within
+ * macros, whose arguments are only known when they run, or within loops kept
+ * as procedures.
+ *
+ * Returns:
+ * True if loops and rotations are being flattened.
+ */
+bool flattening( void ) {
+    return options.flatten && compiling == NULL && procedural == 0;
+}
+
+/*
+ * Applies the rotation that hasn't been written to the file to a point.
  *
  * Input:
- * int x, y  - The center coordinates of the polygon.
- * int r     - The radius of the polygon.
- * int n     - The number of sides of the polygon.
+ * double* x, y - The point, which is rotated in place.
  */
-void solidPolygon( int argc, char* argv[] ) {
-    // Check if we have the correct number of arguments
-    if( argc != 5 ) {
-        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\tsolidpolygon <center_x> <center_y> <radius> <sides>\n" );
+void transform( double* x, double* y ) {
+    if( flatAngle == 0 ) {
+        return;
+    }
+
+    // Quarter turns are exact, so that points on the axes stay on them
+    double turn = fmod( flatAngle, 360 );
+    double c, s;
+    if( fmod( turn, 90 ) == 0 ) {
+        int quarter = ((int)(turn / 90) + 4) % 4;
+        c = (double[]){ 1, 0, -1, 0 }[quarter];
+        s = (double[]){ 0, 1, 0, -1 }[quarter];
     } else {
-        // Alloc space
-        argv[5] = (char*)malloc(sizeof(char) + 1);
-        memset( argv[5], 0, sizeof(char) + 1 );
-
-        // Make sure the alloc succeeded
-        if( argv[5] != NULL ) {
-            // Set the args for a solid path
-            argv[5][0] = '1';
-            argc++;
-
-            // Call path with new args added
-            polygon(argc, argv);
-        } else {
-            printf( "\nERROR:\tFailed to allocate args list!\n" );
-            return;
-        }
+        c = cos( turn * M_PI / 180 );
+        s = sin( turn * M_PI / 180 );
+    }
 
-        // Free the extra args we added
-        free(argv[5]);
+    double rotatedX = *x * c - *y * s;
+    *y = *x * s + *y * c;
+    *x = rotatedX;
+}
+
+/*
+ * Writes the rotation that hasn't been written to the file, for commands
+ * that can't be flattened, and so draw in the coordinate system of the file.
+ */
+void materialize( void ) {
+    if( flatAngle != 0 ) {
+        backend->rotate( session, (Arg){ flatAngle } );
+        flatAngle = 0;
     }
 }
+
 /*
- * Command state to execute rotations
+ * Estimates the size of a block once it is flattened.
  *
  * Input:
- * int deg - degrees to rotate by
+ * Node* body - The first command in the block.
+ *
+ * Returns:
+ * The estimated size in bytes, or SIZE_MAX if it is too large to tell.
  */
-void rotate( int argc, char* argv[] ) {
+size_t flatSize( Node* body ) {
+    size_t size = 0;
+    for( Node* node = body; node != NULL; node = node->next ) {
+        void (*state)(Node* node) = findState( node->argv[0] );
+        size_t inner = FLAT_COMMAND_BYTES;
+        long count;
+
+        if( state == loop ) {
+            if( node->argc != 2 || !parseInteger( node->argv[1], &count ) || count < 0 ) {
+                return SIZE_MAX;
+            }
+            size_t iteration = flatSize( node->body );
+            if( count > 0 && iteration > SIZE_MAX / count ) {
+                return SIZE_MAX;
+            }
+            inner = iteration * count;
+        } else if( state == rotate ) {
+            inner = flatSize( node->body );
+        } else if( state == image || state == import ) {
+            // Images can't be repeated, and imports aren't read until they run
+            return SIZE_MAX;
+        } else if( state == text && node->argc == 6 ) {
+            inner += 2 * FLAT_NUMBER_BYTES + strlen( node->argv[5] );
+        } else if( isPathCommand( node->argv[0] ) ) {
+            inner += FLAT_POINT_BYTES * (node->pointc / 2 + 1);
+        } else if( state == circle || state == solidCircle || state == patternCircle ) {
+            inner += 3 * FLAT_NUMBER_BYTES;
+        } else if( (((state == polygon || state == solidPolygon) && node->argc == 5
+                     && parseInteger( node->argv[4], &count ))
+                    || (state == patternPolygon && node->argc == 6 && parseInteger( node->argv[5], &count )))
+                   && count > 0 ) {
+            inner += count < SIZE_MAX / FLAT_POINT_BYTES ? FLAT_POINT_BYTES * count : SIZE_MAX;
+        }
+
+        if( inner > SIZE_MAX - size ) {
+            return SIZE_MAX;
+        }
+        size += inner;
+    }
+
+    return size;
+}
+
+/*
+ * Checks if shapes may be drawn as instances of procedures. A procedure is
+ * defined where a shape is drawn the second time, so that has to be somewhere
+ * that certainly runs before every later call: not within a macro, a form or
+ * a loop kept as a procedure. The definition also mustn't be culled.
+ *
+ * Returns:
+ * True if shapes may be drawn as instances.
+ */
+bool instancing( void ) {
+    return options.instance && page == NULL && compiling == NULL && !inForm && procedural == 0;
+}
+
+/*
+ * Draws a path as a call to a procedure, if a path of the same shape has been
+ * drawn before. The procedure is defined the second time the shape is drawn.
+ * It builds the path relative to the position it is called with, so it is
+ * called with the first point of the path.
+ *
+ * Input:
+ * const int64_t* points - The points of the path, in steps of the current
+ *                         precision, as pairs of coordinates.
+ * int count             - The number of points.
+ * bool curve            - Whether the path is a curve, drawn three points
+ *                         at a time.
+ *
+ * Returns:
+ * True if the path was drawn, false if it is to be written as usual.
+ */
+bool drawInstance( const int64_t* points, int count, bool curve ) {
+    bool define;
+    int id = instanceFind( points, count, curve, &define );
+    if( id == 0 ) {
+        return false;
+    }
+
+    // The points of each curve are relative to its start, and points left
+    // over after the last curve are joined with lines
+    if(define) {
+        int curved = curve ? ( count - 1 ) / 3 * 3 : 0;
+        writerPrintf( session, "/g_%d { newpath moveto\n", id );
+        for( int i = 1; i < count; i++ ) {
+            int from = i <= curved ? ( i - 1 ) / 3 * 3 : i - 1;
+            writeUnits( points[2 * i] - points[2 * from] );
+            writerPrintf( session, " " );
+            writeUnits( points[2 * i + 1] - points[2 * from + 1] );
+            if( i > curved ) {
+                writerPrintf( session, " rlineto\n" );
+            } else {
+                writerPrintf( session, i % 3 == 0 ? "\nrcurveto\n" : "\n" );
+            }
+        }
+        writerPrintf( session, "} bind def\n" );
+    }
+
+    writeUnits( points[0] );
+    writerPrintf( session, " " );
+    writeUnits( points[1] );
+    writerPrintf( session, " g_%d\n", id );
+    return true;
+}
+
+/*
+ * Looks up the state of a built in command.
+ *
+ * Input:
+ * const char* name - The name of the command.
+ *
+ * Returns:
+ * The state, or NULL if there is no built in command of that name.
+ */
+void (*findState( const char* name ))(Node* node) {
+    int i = findCommand( name );
+    return i < 0 ? NULL : states[i];
+}
+
+/*
+ * Finds the index of a built-in command.
+ *
+ * Input:
+ * const char* name - The name of the command.
+ *
+ * Returns:
+ * The index of the command, or -1 if it isn't built in.
+ */
+int findCommand( const char* name ) {
+    for( int i = 0; i < NUM_COMMANDS; i++ ) {
+        if( strcmp( commands[i], name ) == 0 ) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Finds the area a block draws in, for a block that can be written as a form.
+ * Commands with invalid arguments are left out, as they don't draw anything.
+ *
+ * Input:
+ * Node* body    - The first command in the block.
+ * double box[4] - Used to return the bounding box of the paths drawn, as the
+ *                 lower left and upper right corners.
+ * double* width - Used to return the widest line the paths may be stroked with.
+ *
+ * Returns:
+ * True if the block draws something, and draws the same thing every time it
+ * runs without changing the coordinate system. False otherwise.
+ */
+bool blockBounds( Node* body, double box[4], double* width ) {
+    box[0] = box[1] = INFINITY;
+    box[2] = box[3] = -INFINITY;
+    *width = gstatePending()->lineWidth;
+
+    for( Node* node = body; node != NULL; node = node->next ) {
+        void (*state)(Node* node) = findState( node->argv[0] );
+        char** argv = node->argv;
+        double x, y, r;
+
+        if( state == NULL || state == rotate || state == image || state == text || state == import ) {
+            // Macros are opaque, rotations accumulate, images are read from
+            // the file after the command drawing them, the extent of text
+            // depends on the font, and imports aren't read until they run
+            return false;
+        } else if( state == loop ) {
+            // Every iteration draws the same paths
+            double inner[4];
+            double innerWidth;
+            if( !blockBounds( node->body, inner, &innerWidth ) ) {
+                return false;
+            }
+            addBounds( box, inner[0], inner[1], 0 );
+            addBounds( box, inner[2], inner[3], 0 );
+            *width = fmax( *width, innerWidth );
+        } else if( isPathCommand( argv[0] ) ) {
+            // Pattern fills take the pattern before the coordinates
+            int first = state == patternPath ? 2 : 1;
+            if( node->argc == first + 2 && parseNumber( argv[first], &x ) && parseNumber( argv[first + 1], &y ) ) {
+                addBounds( box, x, y, 0 );
+                // Curves lie within their control points
+                for( int i = 0; i < node->pointc; i += 2 ) {
+                    if( parseNumber( node->points[i], &x ) && parseNumber( node->points[i + 1], &y ) ) {
+                        addBounds( box, x, y, 0 );
+                    }
+                }
+            }
+        } else if( state == circle || state == solidCircle || state == polygon || state == solidPolygon
+                   || state == patternCircle || state == patternPolygon ) {
+            int first = state == patternCircle || state == patternPolygon ? 2 : 1;
+            if( node->argc >= first + 3 && parseNumber( argv[first], &x ) && parseNumber( argv[first + 1], &y )
+                && parseNumber( argv[first + 2], &r ) ) {
+                addBounds( box, x, y, fabs(r) );
+            }
+        } else if( state == lineWidth ) {
+            if( node->argc == 2 && parseNumber( argv[1], &r ) ) {
+                *width = fmax( *width, r );
+            }
+        }
+    }
+
+    return box[0] <= box[2];
+}
+
+/*
+ * Grows a bounding box to include a square around a point.
+ *
+ * Input:
+ * double box[4] - The bounding box to grow.
+ * double x, y   - The center of the square.
+ * double r      - Half the width of the square.
+ */
+void addBounds( double box[4], double x, double y, double r ) {
+    box[0] = fmin( box[0], x - r );
+    box[1] = fmin( box[1], y - r );
+    box[2] = fmax( box[2], x + r );
+    box[3] = fmax( box[3], y + r );
+}
+
+/*
+ * Looks up a pattern by name.
+ *
+ * Input:
+ * const char* name - The name of the pattern.
+ *
+ * Returns:
+ * The pattern, or NULL if no pattern of that name has been defined.
+ */
+Pattern* findPattern( const char* name ) {
+    for( Pattern* tile = patterns; tile != NULL; tile = tile->next ) {
+        if( strcmp( tile->name, name ) == 0 ) {
+            return tile;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Compiles a pattern into a PostScript Level 2 tiling pattern in the session.
+ * The tile is painted by the RIP, which may cache it, wherever a shape is
+ * filled with the pattern.
+ *
+ * Input:
+ * Pattern* tile - The pattern to compile.
+ */
+void compilePattern( Pattern* tile ) {
+    // Shapes can't be filled with patterns in formats without them
+    if( !(backend->features & BACKEND_PATTERNS) ) {
+        return;
+    }
+
+    for( Node* node = tile->body; node != NULL; node = node->next ) {
+        defineFonts( node );
+    }
+
+    writerPrintf( session, "/pat_%s <<\n/PatternType 1\n/PaintType 1\n/TilingType 1\n/BBox [0 0 ", tile->name );
+    writeNumber( tile->width );
+    writerPrintf( session, " " );
+    writeNumber( tile->height );
+    writerPrintf( session, "]\n/XStep " );
+    writeNumber( tile->width );
+    writerPrintf( session, "\n/YStep " );
+    writeNumber( tile->height );
+    writerPrintf( session, "\n/PaintProc { pop\n" );
+
+    // The tile is painted in its own graphics state, and always starts with
+    // the default style
+    GState savedPending = *gstatePending();
+    *gstatePending() = gstateInitial();
+    gstatePush();
+    gstateForget( GS_ALL );
+
+    // Like a form, the tile can't hold forms or define procedures, and has
+    // its own coordinate system
+    bool outerForm = inForm;
+    double outerAngle = flatAngle;
+    inForm = true;
+    flatAngle = 0;
+    executeBlock( tile->body );
+    inForm = outerForm;
+    flatAngle = outerAngle;
+
+    gstatePop();
+    *gstatePending() = savedPending;
+
+    writerPrintf( session, "} bind\n>> matrix makepattern def\n" );
+}
+
+/*
+ * Looks up a font defined in the session.
+ *
+ * Input:
+ * const char* name - The name of the font.
+ * double size      - The size it is scaled to.
+ *
+ * Returns:
+ * The font, or NULL if it hasn't been defined at that size.
+ */
+Font* findFont( const char* name, double size ) {
+    for( Font* font = fonts; font != NULL; font = font->next ) {
+        if( font->size == size && strcmp( font->name, name ) == 0 ) {
+            return font;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Defines the fonts used by text in a command, or in its block, that haven't
+ * been defined in the session. Each is looked up and scaled once, and kept
+ * under a short name. They are defined before the command runs, at the top
+ * level of the file, so that they are defined wherever the text is written:
+ * within a macro, a form, a pattern or a loop. Text scaled by a macro
+ * parameter looks up its font itself.
+ *
+ * Input:
+ * Node* node - The command.
+ */
+void defineFonts( Node* node ) {
+    // Text can't be written in formats without it
+    if( !(backend->features & BACKEND_TEXT) ) {
+        return;
+    }
+
+    double size;
+    if( findState( node->argv[0] ) == text && node->argc == 6 && psName( node->argv[1] )
+        && parseNumber( node->argv[2], &size ) && findFont( node->argv[1], size ) == NULL ) {
+        Font* font = (Font*)malloc(sizeof(Font));
+        if( font != NULL ) {
+            font->name = strdup( node->argv[1] );
+            font->size = size;
+            font->id = fonts != NULL ? fonts->id + 1 : 1;
+            font->next = fonts;
+            fonts = font;
+
+            writerPrintf( session, "/ft_%d /%s findfont ", font->id, font->name );
+            writeNumber( size );
+            writerPrintf( session, " scalefont def\n" );
+        }
+    }
+
+    for( Node* child = node->body; child != NULL; child = child->next ) {
+        defineFonts( child );
+    }
+}
+
+/*
+ * Checks that a name can be written as a PostScript name, or as part of one,
+ * such as the name of a font, a macro, a parameter or a pattern.
+ *
+ * Input:
+ * const char* name - The name.
+ *
+ * Returns:
+ * True if the name is made of regular characters: printable ASCII other
+ * than whitespace and delimiters.
+ */
+bool psName( const char* name ) {
+    if( name[0] == '\0' ) {
+        return false;
+    }
+    for( const char* at = name; *at != '\0'; at++ ) {
+        if( *at <= ' ' || *at == 127 || strchr( "()<>[]{}/%", *at ) != NULL ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Writes a PostScript string. Backslashes and parentheses are escaped, and
+ * characters that aren't printable ASCII are written as octal escapes, so
+ * the file stays 7-bit clean.
+ *
+ * Input:
+ * const char* string - The string to write, without its parentheses.
+ */
+void writeString( const char* string ) {
+    writerPrintf( session, "(" );
+    while( *string != '\0' ) {
+        // Write the characters that need no escaping at once
+        size_t plain = 0;
+        while( string[plain] >= ' ' && string[plain] <= '~' && string[plain] != '\\'
+               && string[plain] != '(' && string[plain] != ')' ) {
+            plain++;
+        }
+        writerWrite( session, string, plain );
+        string += plain;
+
+        if( *string == '\\' || *string == '(' || *string == ')' ) {
+            writerPrintf( session, "\\%c", *string );
+            string++;
+        } else if( *string != '\0' ) {
+            writerPrintf( session, "\\%03o", (unsigned char)*string );
+            string++;
+        }
+    }
+    writerPrintf( session, ")" );
+}
+
+/*
+ * Looks up a user-defined macro by name.
+ *
+ * Input:
+ * const char* name - The name of the macro.
+ *
+ * Returns:
+ * The macro, or NULL if no macro of that name has been defined.
+ */
+Macro* findMacro( const char* name ) {
+    for( Macro* macro = macros; macro != NULL; macro = macro->next ) {
+        if( strcmp( macro->name, name ) == 0 ) {
+            return macro;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Compiles the body of a macro into a PostScript procedure in the session.
+ * The procedure pops its arguments into a local dictionary, so the body only
+ * needs to be emitted once per session no matter how often it is invoked.
+ *
+ * Input:
+ * Macro* macro - The macro to compile.
+ */
+void compileMacro( Macro* macro ) {
+    // Formats without procedures expand the body wherever it is invoked
+    if( !(backend->features & BACKEND_PROCEDURES) ) {
+        return;
+    }
+
+    for( Node* node = macro->body; node != NULL; node = node->next ) {
+        defineFonts( node );
+    }
+
+    writerPrintf( session, "/m_%s {\n", macro->name );
+    if( macro->paramc > 0 ) {
+        // Bind the arguments, which are on the stack in reverse order
+        writerPrintf( session, "%d dict begin\n", macro->paramc );
+        for( int i = macro->paramc - 1; i >= 0; i-- ) {
+            writerPrintf( session, "/p_%s exch def\n", macro->params[i] );
+        }
+    }
+
+    // The procedure may be invoked in any state, and should use whatever
+    // style it is invoked with unless the body sets its own
+    GState savedPending = *gstatePending();
+    gstatePending()->known = 0;
+    gstatePush();
+    gstateForget( GS_ALL );
+    unsigned long changes = gstateChanges();
+    macro->styled = false;
+
+    // Execute the body
+    Macro* outer = compiling;
+    compiling = macro;
+    executeBlock( macro->body );
+    compiling = outer;
+
+    if( gstateChanges() != changes ) {
+        macro->styled = true;
+    }
+    gstatePop();
+    *gstatePending() = savedPending;
+
+    if( macro->paramc > 0 ) {
+        writerPrintf( session, "end\n" );
+    }
+    writerPrintf( session, "} bind def\n" );
+}
+
+/*
+ * Emits a call to a compiled macro: its arguments, followed by its name.
+ *
+ * Input:
+ * Macro* macro - The macro to invoke.
+ * Node* node   - The invocation, with the macro's arguments.
+ */
+void invokeMacro( Macro* macro, Node* node ) {
+    int argc = node->argc;
+    char** argv = node->argv;
+
+    // Check if we have the correct number of arguments
+    if( argc - 1 != macro->paramc ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\t%s", macro->name );
+        for( int i = 0; i < macro->paramc; i++ ) {
+            printf( " <%s>", macro->params[i] );
+        }
+        printf( "\n" );
+        return;
+    }
+
+    // Ensure every argument is a number, or a parameter of an enclosing macro
+    double values[MAX_MACRO_PARAMS];
+    for( int i = 1; i < argc; i++ ) {
+        if( !numArg( argv[i], &values[i - 1] ) ) {
+            printf( "\nERROR:\tArguments must be numbers!\n" );
+            return;
+        }
+    }
+
+    // Formats without procedures draw the body here instead
+    if( !(backend->features & BACKEND_PROCEDURES) ) {
+        expandMacro( macro, values );
+        return;
+    }
+
+    // The procedure draws in the coordinate system of the file
+    materialize();
+
+    for( int i = 1; i < argc; i++ ) {
+        writeArg( argv[i], values[i - 1] );
+        writerPrintf( session, " " );
+    }
+    writerPrintf( session, "m_%s\n", macro->name );
+
+    // What the procedure paints isn't known until it runs
+    cullUnknown();
+
+    // The procedure leaves behind whatever style it set
+    if( macro->styled ) {
+        gstateForget( GS_ALL );
+    }
+}
+
+/*
+ * Executes the body of a macro where it is invoked, for formats without
+ * procedures. Its parameters are bound to the values of the arguments while
+ * it runs. The body draws in the coordinate system in effect, so flattened
+ * rotations still apply to it.
+ *
+ * Input:
+ * Macro* macro         - The macro to expand.
+ * const double* values - The values of its arguments.
+ */
+void expandMacro( Macro* macro, const double* values ) {
+    // A macro invoking itself would be expanded forever
+    for( Binding* outer = binding; outer != NULL; outer = outer->outer ) {
+        if( outer->macro == macro ) {
+            printf( "\nERROR:\tMacro '%s' cannot invoke itself!\n", macro->name );
+            return;
+        }
+    }
+
+    Binding frame = { .macro = macro, .outer = binding };
+    memcpy( frame.values, values, macro->paramc * sizeof(double) );
+    binding = &frame;
+    executeBlock( macro->body );
+    binding = frame.outer;
+}
+
+/*
+ * Resolves an argument that refers to a parameter of the macro currently
+ * being compiled.
+ *
+ * Input:
+ * const char* arg - The argument to resolve.
+ *
+ * Returns:
+ * The PostScript name bound to the parameter, or NULL if the argument does
+ * not name a parameter (or no macro is being compiled).
+ */
+const char* paramRef( const char* arg ) {
+    // Large enough for the prefix and any reasonable argument
+    static char ref[258];
+
+    if( compiling != NULL ) {
+        for( int i = 0; i < compiling->paramc; i++ ) {
+            if( strcmp( compiling->params[i], arg ) == 0 ) {
+                snprintf( ref, sizeof(ref), "p_%s", arg );
+                return ref;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Parses a numeric argument. Inside a macro body, an argument naming one of
+ * the macro's parameters is also accepted, and has no value until the
+ * procedure runs.
+ *
+ * Input:
+ * const char* arg - The argument to parse.
+ * double* value   - Used to return the value of the argument (0 for parameters).
+ *
+ * Returns:
+ * True if the argument is a number or a parameter, false otherwise.
+ */
+bool numArg( const char* arg, double* value ) {
+    if( paramRef( arg ) != NULL ) {
+        *value = 0;
+        return true;
+    }
+
+    return boundArg( arg, value ) || parseNumber( arg, value );
+}
+
+/*
+ * Resolves an argument that refers to a parameter of the macro currently
+ * being expanded.
+ *
+ * Input:
+ * const char* arg - The argument to resolve.
+ * double* value   - Used to return the value bound to the parameter.
+ *
+ * Returns:
+ * True if the argument names a parameter of the macro, false otherwise (or
+ * if no macro is being expanded).
+ */
+bool boundArg( const char* arg, double* value ) {
+    if( binding != NULL ) {
+        for( int i = 0; i < binding->macro->paramc; i++ ) {
+            if( strcmp( binding->macro->params[i], arg ) == 0 ) {
+                *value = binding->values[i];
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Makes the argument passed to the backend for a numeric argument, naming the
+ * macro parameter it refers to, if any.
+ *
+ * Input:
+ * const char* arg - The argument as given in the command.
+ * double value    - The numeric value of the argument.
+ *
+ * Returns:
+ * The argument for the backend.
+ */
+Arg makeArg( const char* arg, double value ) {
+    return (Arg){ value, paramRef( arg ) != NULL ? arg : NULL };
+}
+
+/*
+ * Starts a top-level shape. Any style changes are written first, so that they
+ * outlast the shape, and then the graphics state is saved.
+ */
+void beginShape( void ) {
+    flatAngle = 0;
+    backend->sync( session, GS_ALL );
+    if( page != NULL ) {
+        cullKeep( session );
+    }
+    backend->save( session );
+    gstatePush();
+    if( page != NULL ) {
+        cullStart();
+    }
+}
+
+/*
+ * Ends a top-level shape, restoring the graphics state saved for it.
+ */
+void endShape( void ) {
+    backend->restore( session );
+    gstatePop();
+    if( page != NULL ) {
+        cullEnd( session );
+    }
+
+    // Let a downstream consumer start on the shape
+    if(streaming) {
+        writerFlush(session);
+    }
+}
+
+/*
+ * Paints the current path with the current style, writing only the parts of
+ * the style that have changed.
+ *
+ * Input:
+ * bool solid       - Whether to fill the path, or stroke it.
+ * const char* fill - The pattern to fill the path with instead, or NULL.
+ */
+void paint( bool solid, const char* fill ) {
+    if( fill != NULL ) {
+        // The pattern takes the place of the color until it is set again
+        writerPrintf( session, "pat_%s setpattern\nfill\n", fill );
+        analyzePaint();
+        gstateForget( GS_COLOR );
+        if( compiling != NULL ) {
+            compiling->styled = true;
+        }
+
+        // The tile may leave gaps, so the fill doesn't hide what's beneath
+        cullPaint( false, 0 );
+        return;
+    }
+
+    backend->paint( session, solid );
+    cullPaint( solid, gstatePending()->lineWidth );
+}
+
+/*
+ * Claims the descriptor that streamed sessions are written to. This is the
+ * descriptor given with --output-fd, or stdout otherwise.
+ *
+ * When sessions are streamed to stdout, the interpreter's own output is moved
+ * to stderr so the two don't mix: stdout is redirected to stderr, and the
+ * original stdout is kept for the sessions.
+ *
+ * Returns:
+ * The descriptor to write streamed sessions to, or -1 on failure.
+ */
+int claimStream( void ) {
+    if( streamFd < 0 ) {
+        int fd = options.outputFd >= 0 ? options.outputFd : STDOUT_FILENO;
+        if( fd == STDOUT_FILENO ) {
+            fflush(stdout);
+            streamFd = dup(STDOUT_FILENO);
+            if( streamFd >= 0 ) {
+                dup2( STDERR_FILENO, STDOUT_FILENO );
+            }
+        } else {
+            streamFd = fd;
+        }
+    }
+
+    return streamFd;
+}
+
+/*
+ * Checks if any of the given commands, or the commands within their blocks,
+ * begins a session that is streamed to stdout.
+ *
+ * Input:
+ * const Node* nodes - The first of the commands.
+ *
+ * Returns:
+ * True if a session is streamed to stdout.
+ */
+bool streamsToStdout( const Node* nodes ) {
+    if( options.analyze || options.outputFd >= 0 ) {
+        return false;
+    }
+
+    for( const Node* node = nodes; node != NULL; node = node->next ) {
+        if( node->argc == 2 && strcmp( node->argv[0], "begin" ) == 0 && strcmp( node->argv[1], "-" ) == 0 ) {
+            return true;
+        }
+        if( streamsToStdout( node->body ) ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Writes a numeric argument to the session. Arguments that name a macro
+ * parameter are written as a reference to it instead.
+ *
+ * Input:
+ * const char* arg - The argument as given in the command.
+ * double value    - The numeric value of the argument.
+ */
+void writeArg( const char* arg, double value ) {
+    const char* ref = paramRef( arg );
+    if( ref != NULL ) {
+        writerPrintf( session, "%s", ref );
+    } else {
+        writeNumber( value );
+    }
+}
+
+/*
+ * Writes a number to the session with the current precision.
+ *
+ * Input:
+ * double value - The number to write.
+ */
+void writeNumber( double value ) {
+    char buf[NUMBER_BUF_SIZE];
+    int length = formatNumber( buf, value );
+    writerWrite( session, buf, length );
+}
+
+/*
+ * Writes a quantized number to the session, as compactly as possible.
+ *
+ * Input:
+ * int64_t units - The number, in steps of the current precision.
+ */
+void writeUnits( int64_t units ) {
+    char buf[NUMBER_BUF_SIZE];
+    int length = formatUnits( buf, units );
+    writerWrite( session, buf, length );
+}
+
+/*
+ * Writes a line to a quantized point, with lineto or rlineto, whichever is
+ * shorter.
+ *
+ * Input:
+ * int64_t x, y            - The point, in steps of the current precision.
+ * int64_t* lastX, lastY   - The current point, which becomes the given one.
+ */
+void writeLine( int64_t x, int64_t y, int64_t* lastX, int64_t* lastY ) {
+    char absX[NUMBER_BUF_SIZE], absY[NUMBER_BUF_SIZE];
+    char relX[NUMBER_BUF_SIZE], relY[NUMBER_BUF_SIZE];
+    int absolute = formatUnits( absX, x ) + formatUnits( absY, y );
+    int offset = formatUnits( relX, x - *lastX ) + formatUnits( relY, y - *lastY );
+
+    // rlineto is one character longer
+    if( offset + 1 < absolute ) {
+        writerPrintf( session, "%s %s rlineto", relX, relY );
+    } else {
+        writerPrintf( session, "%s %s lineto", absX, absY );
+    }
+    *lastX = x;
+    *lastY = y;
+}
+
+/*
+ * Writes a curve from the current point through two quantized control points,
+ * with curveto or rcurveto, whichever is shorter. The points of rcurveto are
+ * relative to the start of the curve.
+ *
+ * Input:
+ * const int64_t points[6] - The control points and the end of the curve, in
+ *                           steps of the current precision.
+ * int64_t* lastX, lastY   - The current point, which becomes the end.
+ */
+void writeCurve( const int64_t points[6], int64_t* lastX, int64_t* lastY ) {
+    size_t absolute = 0, offset = 0;
+    for( int i = 0; i < 6; i += 2 ) {
+        absolute += unitsLength( points[i] ) + unitsLength( points[i + 1] );
+        offset += unitsLength( points[i] - *lastX ) + unitsLength( points[i + 1] - *lastY );
+    }
+
+    // rcurveto is one character longer
+    bool offsetCurve = offset + 1 < absolute;
+    for( int i = 0; i < 6; i += 2 ) {
+        writeUnits( offsetCurve ? points[i] - *lastX : points[i] );
+        writerPrintf( session, " " );
+        writeUnits( offsetCurve ? points[i + 1] - *lastY : points[i + 1] );
+        writerPrintf( session, "\n" );
+    }
+    writerPrintf( session, offsetCurve ? "rcurveto" : "curveto" );
+    *lastX = points[4];
+    *lastY = points[5];
+}
+
+/*
+ * Gets the length of a quantized number once it is written.
+ *
+ * Input:
+ * int64_t units - The number, in steps of the current precision.
+ *
+ * Returns:
+ * The number of characters it is written with.
+ */
+size_t unitsLength( int64_t units ) {
+    char buf[NUMBER_BUF_SIZE];
+    return formatUnits( buf, units );
+}
+
+/*
+ * Draws a user-defined path from the points given to a path command.
+ *
+ * Input:
+ * Node* node - The path command, with its points.
+ *   float x, y - Starting point for the path.
+ * bool closed - Whether the generated path will be closed or open.
+ * bool solid  - Whether the generated path should be filled or not.
+ * bool curve  - Whether the generated path is based on curves or lines.
+ * const char* fill - The pattern to fill the path with, or NULL.
+ */
+void drawPath( Node* node, bool closed, bool solid, bool curve, const char* fill ) {
+    // Check if we have the correct number of arguments
+    if( node->argc != 3 ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\t%s <start_x> <start_y>\n", node->argv[0] );
+        return;
+    }
+
+    // Get the starting point of the path
+    double startX, startY;
+    if( !numArg( node->argv[1], &startX ) || !numArg( node->argv[2], &startY ) ) {
+        printf( "\nERROR:\tArguments must be numbers!\n" );
+        return;
+    }
+    double drawX = startX, drawY = startY;
+    transform( &drawX, &drawY );
+
+    // With --instance, a path drawn before at another position is written as
+    // a call to a procedure that draws it. Points are quantized relative to
+    // the start, so that rounding doesn't depend on the position.
+    if( instancing() ) {
+        int count = node->pointc / 2 + 1;
+        int64_t* points = (int64_t*)malloc( 2 * count * sizeof(int64_t) );
+        bool valid = points != NULL && quantize( drawX, &points[0] ) && quantize( drawY, &points[1] );
+        for( int i = 0; i < node->pointc && valid; i += 2 ) {
+            double x, y;
+            valid = parseNumber( node->points[i], &x ) && parseNumber( node->points[i + 1], &y );
+            if(valid) {
+                transform( &x, &y );
+                valid = quantize( x - drawX, &points[i + 2] ) && quantize( y - drawY, &points[i + 3] );
+                points[i + 2] += points[0];
+                points[i + 3] += points[1];
+            }
+        }
+        bool drawn = valid && count >= INSTANCE_MIN_POINTS && drawInstance( points, count, curve );
+        free(points);
+
+        if(drawn) {
+            if(closed) {
+                backend->closePath( session );
+            }
+            paint( solid, fill );
+            if(interactive) {
+                printf( "Path finished.\n" );
+            }
+            return;
+        }
+    }
+
+    // With --relative, points are quantized, and each line is written
+    // relative to the previous point wherever that is shorter. Each curve is
+    // written relative to its own start, the end of the one before, wherever
+    // that is shorter. That needs every point to be known, which parameters of
+    // a macro aren't.
+    int64_t lastX, lastY;
+    bool relative = options.relative && !paramRef( node->argv[1] ) && !paramRef( node->argv[2] )
+                    && quantize( drawX, &lastX ) && quantize( drawY, &lastY );
+    for( int i = 0; i < node->pointc && relative; i += 2 ) {
+        double x, y;
+        int64_t unitsX, unitsY;
+        if( numArg( node->points[i], &x ) && numArg( node->points[i + 1], &y ) ) {
+            transform( &x, &y );
+            relative = !paramRef( node->points[i] ) && !paramRef( node->points[i + 1] )
+                       && quantize( x, &unitsX ) && quantize( y, &unitsY );
+        }
+    }
+
+    // Begin the path in the file
+    backend->newPath( session );
+    if(relative) {
+        writeUnits( lastX );
+        writerPrintf( session, " " );
+        writeUnits( lastY );
+        writerPrintf( session, " moveto\n" );
+    } else {
+        backend->moveTo( session, makeArg( node->argv[1], drawX ), makeArg( node->argv[2], drawY ) );
+    }
+    cullPoint( startX, startY );
+    if(curve) {
+        cullCurve();
+    }
+
+    // Add each of the points. The points of a curve are collected three at a
+    // time, and each three are written or passed to the backend as a curve.
+    Arg controls[6];
+    int64_t units[6];
+    int controlCount = 0;
+    for( int i = 0; i < node->pointc; i += 2 ) {
+        char* xC = node->points[i];
+        char* yC = node->points[i + 1];
+
+        // Convert the provided strings to numbers
+        double x, y;
+        if( numArg( xC, &x ) && numArg( yC, &y ) ) {
+            double pointX = x, pointY = y;
+            transform( &pointX, &pointY );
+
+            // Add the next point to the path
+            if( relative && curve ) {
+                quantize( pointX, &units[controlCount++] );
+                quantize( pointY, &units[controlCount++] );
+                if( controlCount == 6 ) {
+                    writeCurve( units, &lastX, &lastY );
+                    writerPrintf( session, "\n" );
+                    controlCount = 0;
+                }
+            } else if(relative) {
+                int64_t unitsX, unitsY;
+                quantize( pointX, &unitsX );
+                quantize( pointY, &unitsY );
+                writeLine( unitsX, unitsY, &lastX, &lastY );
+                writerPrintf( session, "\n" );
+            } else if(curve) {
+                controls[controlCount++] = makeArg( xC, pointX );
+                controls[controlCount++] = makeArg( yC, pointY );
+                if( controlCount == 6 ) {
+                    backend->curveTo( session, controls );
+                    controlCount = 0;
+                }
+            } else {
+                backend->lineTo( session, makeArg( xC, pointX ), makeArg( yC, pointY ) );
+            }
+            cullPoint( x, y );
+        } else {
+            printf( "ERROR:\tArguments must be numbers!\n" );
+        }
+    }
+
+    // Points left over after the last curve are joined with lines
+    for( int i = 0; i < controlCount; i += 2 ) {
+        if(relative) {
+            writeLine( units[i], units[i + 1], &lastX, &lastY );
+            writerPrintf( session, "\n" );
+        } else {
+            backend->lineTo( session, controls[i], controls[i + 1] );
+        }
+    }
+
+    // Close the path if option is set
+    if(closed) {
+        backend->closePath( session );
+    }
+
+    // Apply the appropriate path finalizer
+    paint( solid, fill );
+
+    if(interactive) {
+        printf( "Path finished.\n" );
+    }
+}
+
+/*
+ * Command state for drawing a user-defined path.
+ *
+ * Input:
+ * float x, y - Starting point for the path.
+ */
+void path( Node* node ) {
+    drawPath( node, false, false, false, NULL );
+}
+
+/*
+ * Command state for drawing a user-defined closed path.
+ *
+ * Input:
+ * float x, y - Starting point for the path.
+ */
+void closedPath( Node* node ) {
+    drawPath( node, true, false, false, NULL );
+}
+
+/*
+ * Command state for drawing a user-defined solid path.
+ *
+ * Input:
+ * float x, y - Starting point for the path.
+ */
+void solidPath( Node* node ) {
+    drawPath( node, true, true, false, NULL );
+}
+
+/*
+ * Command state for drawing a user-defined bezier curve.
+ *
+ * Input:
+ * float x, y - Starting point for the path.
+ */
+void curve( Node* node ) {
+    drawPath( node, false, false, true, NULL );
+}
+
+/*
+ * Command state for drawing a user-defined, closed bezier curve.
+ *
+ * Input:
+ * float x, y - Starting point for the path.
+ */
+void closedCurve( Node* node ) {
+    drawPath( node, true, false, true, NULL );
+}
+
+/*
+ * Command state for drawing a user-defined, filled bezier curve.
+ *
+ * Input:
+ * float x, y - Starting point for the path.
+ */
+void solidCurve( Node* node ) {
+    drawPath( node, true, true, true, NULL );
+}
+
+/*
+ * Draws a circle at center (x,y) and a given radius.
+ *
+ * Input:
+ * Node* node - The circle command, with its arguments.
+ *   float x, y - The center coordinates of the circle.
+ *   float r    - The radius of the circle.
+ * bool solid - Whether the circle should be filled or not.
+ * const char* fill - The pattern to fill the circle with, or NULL.
+ */
+void drawCircle( Node* node, bool solid, const char* fill ) {
+    char** argv = node->argv;
+
+    // Check if we have the correct number of arguments
+    if( node->argc != 4 ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\t%s <center_x> <center_y> <radius>\n", argv[0] );
+        return;
+    }
+
+    // Get the argument values
+    double x, y, r;
+    if( !numArg( argv[1], &x ) || !numArg( argv[2], &y ) || !numArg( argv[3], &r ) ) {
+        printf( "\nERROR:\tArguments must be numbers!\n" );
+        return;
+    }
+
+    // Create the circle
+    double centerX = x, centerY = y;
+    transform( &centerX, &centerY );
+    backend->arc( session, makeArg( argv[1], centerX ), makeArg( argv[2], centerY ), makeArg( argv[3], r ) );
+    cullArc( x, y, r );
+    paint( solid, fill );
+}
+
+/*
+ * Command state for drawing a circle at center (x,y) and a given radius.
+ *
+ * Input:
+ * float x, y - The center coordinates of the circle.
+ * float r    - The radius of the circle.
+ */
+void circle( Node* node ) {
+    drawCircle( node, false, NULL );
+}
+
+/*
+ * Command state for drawing a filled circle at center (x,y) and a given radius.
+ *
+ * Input:
+ * float x, y - The center coordinates of the circle.
+ * float r    - The radius of the circle.
+ */
+void solidCircle( Node* node ) {
+    drawCircle( node, true, NULL );
+}
+
+/*
+ * Draws an n-sided polygon.
+ *
+ * Input:
+ * Node* node - The polygon command, with its arguments.
+ *   float x, y - The center coordinates of the polygon.
+ *   float r    - The radius of the polygon.
+ *   int n      - The number of sides of the polygon.
+ * bool solid - Whether the polygon should be filled or not.
+ * const char* fill - The pattern to fill the polygon with, or NULL.
+ */
+void drawPolygon( Node* node, bool solid, const char* fill ) {
+    char** argv = node->argv;
+
+    // Check if we have the correct number of arguments
+    if( node->argc != 5 ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\t%s <center_x> <center_y> <radius> <sides>\n", argv[0] );
+        return;
+    }
+
+    // Get the argument values
+    double x, y, r;
+    long n;
+    if( !numArg( argv[1], &x ) || !numArg( argv[2], &y ) || !numArg( argv[3], &r ) ) {
+        printf( "\nERROR:\tArguments must be numbers!\n" );
+        return;
+    }
+    if( !parseInteger( argv[4], &n ) || n < 1 ) {
+        printf( "\nERROR:\tThe number of sides of a polygon must be a positive whole number!\n" );
+        return;
+    }
+
+    // Inside a macro body the center and radius may be parameters, which
+    // are only known when the procedure runs
+    bool symbolic = paramRef( argv[1] ) || paramRef( argv[2] ) || paramRef( argv[3] );
+
+    // With --instance, a polygon drawn before at another position is written
+    // as a call to a procedure that draws it. Corners are quantized relative
+    // to the center, so that rounding doesn't depend on the position.
+    if( instancing() && !symbolic && n >= INSTANCE_MIN_POINTS && n <= INT_MAX / 2 ) {
+        int64_t* points = (int64_t*)malloc( 2 * n * sizeof(int64_t) );
+        double centerX = x, centerY = y;
+        int64_t unitsX, unitsY;
+        transform( &centerX, &centerY );
+        bool valid = points != NULL && quantize( centerX, &unitsX ) && quantize( centerY, &unitsY );
+        for( int i = 0; i < n && valid; i++ ) {
+            double offsetX = r * cos( 2.0 * M_PI * ((double)i / n) );
+            double offsetY = r * sin( 2.0 * M_PI * ((double)i / n) );
+            transform( &offsetX, &offsetY );
+            valid = quantize( offsetX, &points[2 * i] ) && quantize( offsetY, &points[2 * i + 1] );
+            points[2 * i] += unitsX;
+            points[2 * i + 1] += unitsY;
+        }
+        bool drawn = valid && drawInstance( points, n, false );
+        free(points);
+
+        if(drawn) {
+            backend->closePath( session );
+            paint( solid, fill );
+            return;
+        }
+    }
+
+    // With --relative, corners are quantized, and each line is written
+    // relative to the previous corner wherever that is shorter
+    int64_t lastX = 0, lastY = 0;
+    bool relative = options.relative && !symbolic;
+
+    // Calculate the all the points for the polygon
+    for( int i = 0; i < n; i++ ) {
+        double cosI = cos( 2.0 * M_PI * ((double)i / n) );
+        double sinI = sin( 2.0 * M_PI * ((double)i / n) );
+        double cornerX = r * cosI + x, cornerY = r * sinI + y;
+        transform( &cornerX, &cornerY );
+        int64_t unitsX, unitsY;
+
+        if(symbolic) {
+            // Let PostScript compute the point from the unit circle
+            if( paramRef( argv[3] ) ) {
+                writeArg( argv[3], r );
+                writerPrintf( session, " " );
+                writeNumber( cosI );
+                writerPrintf( session, " mul " );
+            } else {
+                writeNumber( r * cosI );
+                writerPrintf( session, " " );
+            }
+            writeArg( argv[1], x );
+            writerPrintf( session, " add " );
+            if( paramRef( argv[3] ) ) {
+                writeArg( argv[3], r );
+                writerPrintf( session, " " );
+                writeNumber( sinI );
+                writerPrintf( session, " mul " );
+            } else {
+                writeNumber( r * sinI );
+                writerPrintf( session, " " );
+            }
+            writeArg( argv[2], y );
+            writerPrintf( session, i == 0 ? " add moveto\n" : " add lineto\n" );
+        } else if( relative && quantize( cornerX, &unitsX ) && quantize( cornerY, &unitsY ) ) {
+            if( i == 0 ) {
+                writeUnits( unitsX );
+                writerPrintf( session, " " );
+                writeUnits( unitsY );
+                writerPrintf( session, " moveto\n" );
+                lastX = unitsX;
+                lastY = unitsY;
+            } else {
+                writeLine( unitsX, unitsY, &lastX, &lastY );
+                writerPrintf( session, "\n" );
+            }
+        } else if( i == 0 ) {
+            // If this is the first point move into position
+            backend->moveTo( session, (Arg){ cornerX }, (Arg){ cornerY } );
+            relative = false;
+        } else {
+            // Set lines for all other points
+            backend->lineTo( session, (Arg){ cornerX }, (Arg){ cornerY } );
+            relative = false;
+        }
+        cullPoint( r * cosI + x, r * sinI + y );
+    }
+
+    // Close the path to complete the polygon
+    backend->closePath( session );
+
+    // Draw the polygon
+    paint( solid, fill );
+}
+
+/*
+ * Command state for drawing an n-sided polygon.
+ *
+ * Input:
+ * float x, y - The center coordinates of the polygon.
+ * float r    - The radius of the polygon.
+ * int n      - The number of sides of the polygon.
+ */
+void polygon( Node* node ) {
+    drawPolygon( node, false, NULL );
+}
+
+/* Command state for drawing a filled n-sided polygon.
+ *
+ * Input:
+ * float x, y - The center coordinates of the polygon.
+ * float r    - The radius of the polygon.
+ * int n      - The number of sides of the polygon.
+ */
+void solidPolygon( Node* node ) {
+    drawPolygon( node, true, NULL );
+}
+
+/*
+ * Gets the pattern that a pattern fill command fills its shape with, and the
+ * command as the solid command it is a variant of, without the pattern.
+ *
+ * Input:
+ * Node* node        - The pattern fill command.
+ * int argc          - The number of arguments the command takes, including
+ *                     the command and the pattern.
+ * const char* usage - How the command is used, printed if it's used wrongly.
+ * char** argv       - Holds the arguments of the shape. Must have room for
+ *                     one fewer than the command takes.
+ * Node* shape       - Used to return the command without the pattern.
+ *
+ * Returns:
+ * The pattern, or NULL if the command is invalid.
+ */
+Pattern* patternArg( Node* node, int argc, const char* usage, char** argv, Node* shape ) {
+    // Check if we have the correct number of arguments
+    if( node->argc != argc ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\t%s\n", usage );
+        return NULL;
+    }
+
+    if( !(backend->features & BACKEND_PATTERNS) ) {
+        printf( "\nERROR:\tPatterns cannot be drawn with the %s backend!\n", backend->name );
+        return NULL;
+    }
+
+    Pattern* tile = findPattern( node->argv[1] );
+    if( tile == NULL ) {
+        printf( "\nERROR:\tUnknown pattern '%s'!\n", node->argv[1] );
+        return NULL;
+    }
+
+    *shape = *node;
+    shape->argc = argc - 1;
+    shape->argv = argv;
+    argv[0] = node->argv[0];
+    for( int i = 2; i < argc; i++ ) {
+        argv[i - 1] = node->argv[i];
+    }
+
+    return tile;
+}
+
+/*
+ * Command state for drawing a user-defined path filled with a pattern.
+ *
+ * Input:
+ * char* pattern - The name of the pattern.
+ * float x, y    - Starting point for the path.
+ */
+void patternPath( Node* node ) {
+    char* argv[3];
+    Node shape;
+    Pattern* tile = patternArg( node, 4, "patternpath <pattern> <start_x> <start_y>", argv, &shape );
+    if( tile != NULL ) {
+        drawPath( &shape, true, true, false, tile->name );
+    }
+}
+
+/*
+ * Command state for drawing a circle filled with a pattern.
+ *
+ * Input:
+ * char* pattern - The name of the pattern.
+ * float x, y    - The center coordinates of the circle.
+ * float r       - The radius of the circle.
+ */
+void patternCircle( Node* node ) {
+    char* argv[4];
+    Node shape;
+    Pattern* tile = patternArg( node, 5, "patterncircle <pattern> <center_x> <center_y> <radius>", argv, &shape );
+    if( tile != NULL ) {
+        drawCircle( &shape, true, tile->name );
+    }
+}
+
+/*
+ * Command state for drawing an n-sided polygon filled with a pattern.
+ *
+ * Input:
+ * char* pattern - The name of the pattern.
+ * float x, y    - The center coordinates of the polygon.
+ * float r       - The radius of the polygon.
+ * int n         - The number of sides of the polygon.
+ */
+void patternPolygon( Node* node ) {
+    char* argv[5];
+    Node shape;
+    Pattern* tile = patternArg( node, 6, "patternpolygon <pattern> <center_x> <center_y> <radius> <sides>",
+                                argv, &shape );
+    if( tile != NULL ) {
+        drawPolygon( &shape, true, tile->name );
+    }
+}
+
+/*
+ * Command state for drawing a binary PPM or PGM image, stretched over a
+ * rectangle. The samples are streamed from the file into the session as they
+ * are written, so the image is never held in memory. As the image operator
+ * reads them from the file after itself, images can't be drawn anywhere that
+ * is run later or more than once: within a macro, a form, a pattern or a loop.
+ *
+ * Input:
+ * char* filename - The image file.
+ * float x, y     - The lower left corner of the image.
+ * float w, h     - The width and height of the image.
+ */
+void image( Node* node ) {
+    Image picture;
+    double rect[4];
+    if( openImage( node, rect, &picture ) ) {
+        drawImage( rect, &picture );
+    }
+}
+
+/*
+ * Checks the arguments of an image command, and opens its file.
+ *
+ * Input:
+ * Node* node      - The image command.
+ * double rect[4]  - Used to return the rectangle the image is drawn in, as its
+ *                   lower left corner, width and height.
+ * Image* picture  - Used to return the opened image.
+ *
+ * Returns:
+ * True if the image was opened, false if an error was reported.
+ */
+bool openImage( Node* node, double rect[4], Image* picture ) {
+    char** argv = node->argv;
+
+    // Check if we have the correct number of arguments
+    if( node->argc != 6 ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\timage <filename> <x> <y> <width> <height>\n" );
+        return false;
+    }
+
+    if( !(backend->features & BACKEND_IMAGES) ) {
+        printf( "\nERROR:\tImages cannot be drawn with the %s backend!\n", backend->name );
+        return false;
+    }
+
+    if( compiling != NULL || inForm || procedural > 0 ) {
+        printf( "\nERROR:\tImages cannot be drawn within a macro, a pattern or a loop!\n" );
+        return false;
+    }
+
+    // Get the argument values
+    for( int i = 0; i < 4; i++ ) {
+        if( !parseNumber( argv[i + 2], &rect[i] ) ) {
+            printf( "\nERROR:\tArguments must be numbers!\n" );
+            return false;
+        }
+    }
+
+    const char* error = imageOpen( picture, argv[1] );
+    if( error != NULL ) {
+        printf( "\nERROR:\t%s!\n", error );
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Draws an opened image, and closes it.
+ *
+ * Input:
+ * const double rect[4] - The rectangle to draw the image in, as its lower
+ *                        left corner, width and height.
+ * Image* picture       - The image.
+ */
+void drawImage( const double rect[4], Image* picture ) {
+    double x = rect[0], y = rect[1], w = rect[2], h = rect[3];
+
+    // Write the image straight to the file, rather than collecting it in
+    // memory with the shapes being generated before it
+    stopPool();
+
+    // Run-length encode the samples only if that makes them shorter
+    bool rle = imageRunLength( picture ) < picture->length;
+
+    // The image is drawn in the unit square, scaled to the rectangle, with
+    // the first row at the top
+    materialize();
+    backend->save( session );
+    gstatePush();
+    writeNumber(x);
+    writerPrintf( session, " " );
+    writeNumber(y);
+    writerPrintf( session, " translate\n" );
+    writeNumber(w);
+    writerPrintf( session, " " );
+    writeNumber(h);
+    writerPrintf( session, " scale\n" );
+    writerPrintf( session, "/%s setcolorspace\n", picture->components == 3 ? "DeviceRGB" : "DeviceGray" );
+    writerPrintf( session, "<<\n/ImageType 1\n/Width %d\n/Height %d\n/BitsPerComponent 8\n/Decode [",
+                  picture->width, picture->height );
+    for( int i = 0; i < picture->components; i++ ) {
+        // Samples may be scaled to less than 255
+        writerPrintf( session, i > 0 ? " 0 " : "0 " );
+        writeNumber( 255.0 / picture->maxval );
+    }
+    writerPrintf( session, "]\n/ImageMatrix [%d 0 0 %d 0 %d]\n", picture->width, -picture->height, picture->height );
+    writerPrintf( session, "/DataSource currentfile /ASCII85Decode filter%s\n>> image\n",
+                  rle ? " /RunLengthDecode filter" : "" );
+    imageStream( picture, session, rle );
+    backend->restore( session );
+    gstatePop();
+    imageClose( picture );
+    analyzePaint();
+
+    // The image hides whatever is beneath it
+    cullPoint( x, y );
+    cullPoint( x + w, y );
+    cullPoint( x + w, y + h );
+    cullPoint( x, y + h );
+    cullPaint( true, 0 );
+}
+
+/*
+ * Command state for writing a line of text, starting at (x,y). The font is
+ * scaled once per session, see defineFonts.
+ *
+ * Input:
+ * char* font   - The name of the font, such as Helvetica.
+ * float size   - The size of the font.
+ * float x, y   - The start of the baseline of the text.
+ * char* string - The text, which is the rest of the line.
+ */
+void text( Node* node ) {
+    char** argv = node->argv;
+
+    // Check if we have the correct number of arguments
+    if( node->argc != 6 ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\ttext <font> <size> <x> <y> <string>\n" );
+        return;
+    }
+
+    if( !(backend->features & BACKEND_TEXT) ) {
+        printf( "\nERROR:\tText cannot be written with the %s backend!\n", backend->name );
+        return;
+    }
+
+    if( !psName( argv[1] ) ) {
+        printf( "\nERROR:\tInvalid font name '%s'!\n", argv[1] );
+        return;
+    }
+
+    // Get the argument values
+    double size, x, y;
+    if( !numArg( argv[2], &size ) || !numArg( argv[3], &x ) || !numArg( argv[4], &y ) ) {
+        printf( "\nERROR:\tArguments must be numbers!\n" );
+        return;
+    }
+
+    // Glyphs are drawn in the coordinate system of the file
+    materialize();
+
+    Font* font = paramRef( argv[2] ) == NULL ? findFont( argv[1], size ) : NULL;
+    if( font != NULL ) {
+        writerPrintf( session, "ft_%d setfont\n", font->id );
+    } else {
+        writerPrintf( session, "/%s findfont ", argv[1] );
+        writeArg( argv[2], size );
+        writerPrintf( session, " scalefont setfont\n" );
+    }
+
+    writeArg( argv[3], x );
+    writerPrintf( session, " " );
+    writeArg( argv[4], y );
+    writerPrintf( session, " moveto\n" );
+    gstateSync( session, GS_COLOR );
+    writeString( argv[5] );
+    writerPrintf( session, " show\n" );
+    analyzePaint();
+
+    // The glyphs aren't known until the text is rendered
+    cullUnknown();
+}
+
+/*
+ * Command state for drawing the paths, circles and polygons of an SVG file,
+ * with the bottom left of the drawing at (0,0). The file is streamed, and each
+ * shape is drawn as soon as it has been read, so files of any size can be
+ * imported. See svg.c for what is imported.
+ *
+ * Input:
+ * char* filename - The SVG file.
+ */
+void import( Node* node ) {
+    // Check if we have the correct number of arguments
+    if( node->argc != 2 ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\timport <filename>\n" );
+        return;
+    }
+
+    Import state = { .relative = options.relative };
+    SvgSink sink =
+            {
+                &state,
+                importBegin,
+                importMove,
+                importLine,
+                importCurve,
+                importClose,
+                importPaint,
+                importCircle
+            };
+
+    int line;
+    const char* error = svgImport( node->argv[1], &sink, &line );
+    if( error != NULL && line > 0 ) {
+        printf( "\nERROR:\t%s:%d: %s!\n", node->argv[1], line, error );
+    } else if( error != NULL ) {
+        printf( "\nERROR:\t%s!\n", error );
+    }
+
+    if(interactive) {
+        printf( "Imported %d shapes from %s.\n", state.shapes, node->argv[1] );
+    }
+}
+
+/*
+ * Starts the path of an imported shape.
+ */
+void importBegin( void* context ) {
+    Import* state = (Import*)context;
+    state->known = false;
+    backend->newPath( session );
+}
+
+/*
+ * Starts a subpath of an imported shape.
+ */
+void importMove( void* context, double x, double y ) {
+    Import* state = (Import*)context;
+    cullPoint( x, y );
+    if( state->relative ) {
+        importPoint( state, x, y );
+        writerPrintf( session, " moveto\n" );
+    } else {
+        transform( &x, &y );
+        backend->moveTo( session, (Arg){ x }, (Arg){ y } );
+    }
+}
+
+/*
+ * Adds a line to an imported shape.
+ */
+void importLine( void* context, double x, double y ) {
+    Import* state = (Import*)context;
+    cullPoint( x, y );
+
+    double drawX = x, drawY = y;
+    transform( &drawX, &drawY );
+    int64_t unitsX, unitsY;
+    if( state->known && quantize( drawX, &unitsX ) && quantize( drawY, &unitsY ) ) {
+        writeLine( unitsX, unitsY, &state->lastX, &state->lastY );
+        writerPrintf( session, "\n" );
+    } else if( state->relative ) {
+        importPoint( state, x, y );
+        writerPrintf( session, " lineto\n" );
+    } else {
+        backend->lineTo( session, (Arg){ drawX }, (Arg){ drawY } );
+    }
+}
+
+/*
+ * Adds a cubic curve to an imported shape.
+ */
+void importCurve( void* context, const double points[6] ) {
+    Import* state = (Import*)context;
+    cullCurve();
+    Arg controls[6];
+    for( int i = 0; i < 6; i += 2 ) {
+        cullPoint( points[i], points[i + 1] );
+        if( state->relative ) {
+            importPoint( state, points[i], points[i + 1] );
+            writerPrintf( session, i < 4 ? " " : " curveto\n" );
+        } else {
+            double x = points[i], y = points[i + 1];
+            transform( &x, &y );
+            controls[i] = (Arg){ x };
+            controls[i + 1] = (Arg){ y };
+        }
+    }
+    if( !state->relative ) {
+        backend->curveTo( session, controls );
+    }
+}
+
+/*
+ * Closes the current subpath of an imported shape.
+ */
+void importClose( void* context ) {
+    Import* state = (Import*)context;
+    // The next line is written in full, rather than tracking the start
+    backend->closePath( session );
+    state->known = false;
+}
+
+/*
+ * Paints an imported shape.
+ */
+void importPaint( void* context, bool filled ) {
+    Import* state = (Import*)context;
+    paint( filled, NULL );
+    state->shapes++;
+}
+
+/*
+ * Draws an imported circle, as the circle command does.
+ */
+void importCircle( void* context, double x, double y, double r, bool filled ) {
+    Import* state = (Import*)context;
+    char args[3][NUMBER_BUF_SIZE + 8];
+    snprintf( args[0], sizeof(args[0]), "%.17g", x );
+    snprintf( args[1], sizeof(args[1]), "%.17g", y );
+    snprintf( args[2], sizeof(args[2]), "%.17g", r );
+    char* argv[4] = { "circle", args[0], args[1], args[2] };
+    Node circle = { .argc = 4, .argv = argv };
+    drawCircle( &circle, filled, NULL );
+    state->shapes++;
+}
+
+/*
+ * Writes a point of an imported shape, quantized when lines are written
+ * relative to the previous point, which then becomes the current point.
+ */
+void importPoint( Import* state, double x, double y ) {
+    transform( &x, &y );
+    state->known = state->relative && quantize( x, &state->lastX ) && quantize( y, &state->lastY );
+    if( state->known ) {
+        writeUnits( state->lastX );
+        writerPrintf( session, " " );
+        writeUnits( state->lastY );
+    } else {
+        writeNumber(x);
+        writerPrintf( session, " " );
+        writeNumber(y);
+    }
+}
+
+/*
+ * Command state to execute rotations
+ *
+ * Input:
+ * float deg - degrees to rotate by
+ * Node* body - The block of commands to rotate
+ */
+void rotate( Node* node ) {
     // Check if we have the correct number of arguments
-    if( argc != 2 ) {
+    if( node->argc != 2 ) {
         printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\trotate <degrees>\n" );
-    } else {
-        if( session == NULL ) {
-            printf( "\nERROR:\tNo active session!\n" );
-            return;
-        }
+        printf( "Usage:\trotate <degrees> { ... }\n" );
+        return;
+    }
 
-        int deg = strtol( argv[1], NULL, 10 );
-        if( errno != 0 ) {
-            printf( "\nERROR:\tArguments must be numbers!\n" );
-            return;
-        }
+    double deg;
+    if( !numArg( node->argv[1], &deg ) ) {
+        printf( "\nERROR:\tArguments must be numbers!\n" );
+        return;
+    }
 
+    cullRotate( deg );
+    if( flattening() ) {
+        // Rotate the coordinates that are written instead
+        flatAngle += deg;
+        executeBlock( node->body );
+    } else {
         // Apply the rotation
-        fprintf( session, "%d rotate\n", deg );
-        while(1) {
-            printf( "\nEnter commands to construct a block of code to rotate:\n" );
-            // Print repeat prompt
-            printf( "+> " );
+        backend->rotate( session, makeArg( node->argv[1], deg ) );
 
-            // Evaluate input for body of the repeat block
-            eval( input, true );
-
-            // Ask the user if they wish to enter more commands
-            printf( "\nFinished constructing rotate block? (y/n) " );
-            char ans[255];
-            // Check input and verify its validity
-            if( fgets(ans, 255, input) != NULL && ans[0] == 'y' && strlen(ans) == 2 ) {
-                break;
-            }
-        }
+        // Evaluate the body of the rotate block
+        executeBody( node->body );
+    }
 
-        printf( "Rotate block finished. Result of block will be rotated %d degrees.\n", deg );
+    if(interactive) {
+        printf( "Rotate block finished. Result of block will be rotated %s degrees.\n", node->argv[1] );
     }
 }
 
@@ -786,52 +2854,126 @@ void rotate( int argc, char* argv[] ) {
  * Input:
  * char* name - The name of the session.
  */
-void begin( int argc, char* argv[] ) {
+void begin( Node* node ) {
     // Check if we have the correct number of arguments
-    if( argc != 2 ) {
+    if( node->argc != 2 ) {
         printf( "\nERROR:\tInvalid number of arguments provided!\n" );
         printf( "Usage:\tbegin <session_name>\n" );
-    } else {
-        // Check if we already have an active session
-        if( session != NULL ) {
+        return;
+    }
+
+    char* endArgs[1] = { "end" };
+    Node endNode = { .argc = 1, .argv = endArgs };
+
+    // Check if we already have an active session
+    if( session != NULL ) {
+        if(interactive) {
             printf( "Active session exists! Do wish to close this session and start a new one? (y/n) " );
+            fflush(stdout);
             char ans[255];
             // Check input and verify its validity
-            if( fgets(ans, 255, input) != NULL && ans[0] == 'y' && strlen(ans) == 2 ) {
+            if( fgets(ans, 255, stdin) != NULL && ans[0] == 'y' && strlen(ans) == 2 ) {
                 // Close the current session
-                end( 1, NULL );
+                end( &endNode );
             } else {
                 // Abort session creation
                 printf( "Aborting session creation...\n" );
                 return;
             }
+        } else {
+            // Scripts can't be asked, so finish the current session
+            printf( "Closing current session before starting a new one.\n" );
+            end( &endNode );
         }
-        // Get the name of the session to create
-        char* name = argv[1];
-
-        // File extension
-        char* ext = ".ps";
-        // The new filename
-        char filename[strlen(name) + strlen(ext)];
+    }
 
-        // Copy session name
-        strcpy( filename, name );
-        // Add the file extension
-        strcpy( filename + strlen(filename), ext );
+    // Get the name of the session to create
+    char* name = node->argv[1];
+
+    // File extension
+    const char* ext = backend->extension;
+    // The new filename
+    char filename[strlen(name) + strlen(ext) + 1];
+
+    // Copy session name
+    strcpy( filename, name );
+    // Add the file extension
+    strcpy( filename + strlen(filename), ext );
+
+    // Sessions named '-', or all sessions if an output descriptor was
+    // given, are streamed rather than written to a file
+    streaming = !options.analyze && (strcmp( name, "-" ) == 0 || options.outputFd >= 0);
+
+    // Open/create the file. A streamed session gets its own copy of the
+    // descriptor, so ending the session doesn't close the stream. Nothing is
+    // written when analyzing.
+    int fd;
+    if( options.analyze ) {
+        fd = open( "/dev/null", O_WRONLY );
+    } else if(streaming) {
+        fd = claimStream();
+        fd = fd >= 0 ? dup(fd) : -1;
+    } else {
+        fd = open( filename, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+    }
+    if( fd >= 0 ) {
+        session = writerOpen( fd, options.asyncOutput );
+        if( session == NULL ) {
+            close(fd);
+        }
+    }
 
-        // Open/create the file
-        session = fopen(filename, "w+");
+    // Check if open succeeded
+    if( session == NULL ) {
+        printf( "\nERROR:\tFailed to create session!\n" );
+        return;
+    }
 
-        // Check if open succeeded
+    // When culling, collect the page in memory until it is finished
+    if( options.cull ) {
+        page = session;
+        session = writerOpenMemory();
         if( session == NULL ) {
             printf( "\nERROR:\tFailed to create session!\n" );
-        } else {
-            // Write PostScript metadata to file
-            char* head = "%!PS\n";
-            fprintf( session, "%s", head );
-            printf( "Created session: %s\n", name );
+            writerClose( page );
+            page = NULL;
+            return;
+        }
+        cullReset();
+    }
+
+    // Write the header of the format to file
+    backend->begin( session );
+
+    // The page starts with the default style, and none of the procedures
+    // defined for earlier sessions
+    gstateReset();
+    instanceReset();
+    forgetFonts();
+
+    // Compile existing macros into the prologue, oldest first so that
+    // macros invoking earlier ones are defined after them
+    Macro* compiled = NULL;
+    while( compiled != macros ) {
+        Macro* next = macros;
+        while( next->next != compiled ) {
+            next = next->next;
+        }
+        compileMacro( next );
+        compiled = next;
+    }
+
+    // Then the patterns, whose tiles may invoke macros
+    Pattern* defined = NULL;
+    while( defined != patterns ) {
+        Pattern* next = patterns;
+        while( next->next != defined ) {
+            next = next->next;
         }
+        compilePattern( next );
+        defined = next;
     }
+    printf( "Created session: %s\n", name );
 }
 
 /*
@@ -840,27 +2982,52 @@ void begin( int argc, char* argv[] ) {
  *  Input:
  *  None
  */
-void end( int argc, char* argv[] ) {
+void end( Node* node ) {
     // Check if we have the correct number of arguments
-    if( argc != 1 ) {
+    if( node->argc != 1 ) {
         printf( "\nERROR:\tInvalid number of arguments provided!\n" );
         printf( "Usage:\tend\n" );
+        return;
+    }
+
+    // Check if session is null
+    if( session == NULL ) {
+        printf( "\nERROR: No open session to end!\n" );
+        return;
+    }
+
+    // Dump the generated page
+    backend->end( session );
+
+    // Write the page, leaving out the shapes that are hidden
+    if( page != NULL ) {
+        CullStats stats;
+        cullKeep( session );
+        cullFinish( page, &stats );
+        writerClose( session );
+        session = page;
+        page = NULL;
+        printf( "Culled %d of %d shapes (%zu of %zu bytes).\n", stats.culled, stats.shapes,
+                stats.culledBytes, stats.bytes );
+    }
+
+    if( options.analyze ) {
+        analyzeReport();
+    }
+
+    if( options.instance ) {
+        InstanceStats stats = instanceStats();
+        printf( "Drew %d shapes as instances of %d procedures.\n", stats.instanced, stats.defined );
+    }
+
+    // Close session, waiting for any pending output, and check for
+    // errors. The session is gone either way.
+    bool closed = writerClose( session );
+    session = NULL;
+    if(!closed) {
+        printf( "\nERROR: Failed to write session file: %s\n", strerror(errno) );
     } else {
-        // Check if session is null
-        if( session != NULL ) {
-            // Dump the generated page
-            fprintf( session, "showpage\n" );
-
-            // Close session and check for errors
-            if( fclose( session ) != 0 ) {
-                printf( "\nERROR: Failed to close session file!\n" );
-            } else {
-                session = NULL;
-                printf( "Session ended.\n" );
-            }
-        } else {
-            printf( "\nERROR: No open session to end!\n" );
-        }
+        printf( "Session ended.\n" );
     }
 }
 
@@ -868,134 +3035,517 @@ void end( int argc, char* argv[] ) {
  * Command state for looping construct.
  *
  * Input:
- * int r - Number of times to repeat loop.
+ * int r      - Number of times to repeat loop.
+ * Node* body - The block of commands to repeat.
  */
-void loop( int argc, char* argv[] ) {
+void loop( Node* node ) {
     // Check if we have the correct number of arguments
-    if( argc != 2 ) {
+    if( node->argc != 2 ) {
         printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\tloop <count>\n" );
+        printf( "Usage:\tloop <count> { ... }\n" );
+        return;
+    }
+
+    long count = 0;
+    double bound;
+    bool valid;
+    if( boundArg( node->argv[1], &bound ) ) {
+        // The count is a parameter of a macro being expanded
+        count = (long)bound;
+        valid = bound == count && count >= 0;
     } else {
-        if( session == NULL ) {
-            printf( "\nERROR:\tNo active session!\n" );
-            return;
+        valid = parseInteger( node->argv[1], &count ) && count >= 0;
+    }
+    if( paramRef( node->argv[1] ) == NULL && !valid ) {
+        printf( "\nERROR:\tLoop count must be a non-negative whole number!\n" );
+        return;
+    }
+
+    // With --flatten, write every iteration of loops that fit in the budget,
+    // and keep the rest as procedures. Formats without loops get every
+    // iteration regardless.
+    bool flat = backend->repeat == NULL;
+    if( !flat && flattening() ) {
+        flat = count == 0 || flatSize( node->body ) <= options.flattenBudget / count;
+        if(!flat) {
+            materialize();
+        }
+    }
+    if(flat) {
+        for( long i = 0; i < count; i++ ) {
+            executeBlock( node->body );
         }
+        if(interactive) {
+            printf( "Loop block finished. Result of block was flattened %s times.\n", node->argv[1] );
+        }
+        return;
+    }
+    procedural++;
+
+    // Start the repeat block
+    backend->repeat( session, makeArg( node->argv[1], count ) );
+
+    // Every iteration must start in the same state, so that only the
+    // changes needed by the first one are written
+    GState start = gstateCurrent();
+    CullMark mark = cullMark();
+
+    // Evaluate the body of the repeat block
+    executeBody( node->body );
+    cullRepeat( mark, count );
+
+    // Set to repeat
+    gstateRevert( session, &start );
+    backend->endRepeat( session );
+    procedural--;
+
+    if(interactive) {
+        printf( "Loop block finished. Result of block will be looped %s times.\n", node->argv[1] );
+    }
+}
+
+/*
+ * Command state to set the color of subsequent shapes.
+ *
+ * Input:
+ * float r, g, b - The red, green and blue components, from 0 to 1.
+ */
+void color( Node* node ) {
+    char** argv = node->argv;
+
+    // Check if we have the correct number of arguments
+    if( node->argc != 4 ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\tcolor <red> <green> <blue>\n" );
+        return;
+    }
 
-        int count = strtol( argv[1], NULL, 10 );
-        if( errno != 0 ) {
+    double rgb[3];
+    for( int i = 0; i < 3; i++ ) {
+        if( !numArg( argv[i + 1], &rgb[i] ) ) {
             printf( "\nERROR:\tArguments must be numbers!\n" );
             return;
         }
+        if( rgb[i] < 0 || rgb[i] > 1 ) {
+            printf( "\nERROR:\tColor components must be between 0 and 1!\n" );
+            return;
+        }
+    }
 
-        // Apply the rotation
-        fprintf( session, "%d {\n", count );
-        while(1) {
-            printf( "\nEnter commands to construct a block of code to loop:\n" );
-            // Print repeat prompt
-            printf( "#> " );
+    GState* pending = gstatePending();
+    if( paramRef( argv[1] ) || paramRef( argv[2] ) || paramRef( argv[3] ) ) {
+        // Parameters are only known when the procedure runs, so the color
+        // has to be set right away
+        for( int i = 0; i < 3; i++ ) {
+            writeArg( argv[i + 1], rgb[i] );
+            writerPrintf( session, " " );
+        }
+        writerPrintf( session, "setrgbcolor\n" );
+        pending->known &= ~GS_COLOR;
+        gstateForget( GS_COLOR );
+        compiling->styled = true;
+    } else {
+        memcpy( pending->color, rgb, sizeof(rgb) );
+        pending->known |= GS_COLOR;
+    }
+}
 
-            // Evaluate input for body of the repeat block
-            eval( input, true );
+/*
+ * Command state to set the line width of subsequent shapes.
+ *
+ * Input:
+ * float width - The width of lines.
+ */
+void lineWidth( Node* node ) {
+    char** argv = node->argv;
 
-            // Ask the user if they wish to enter more commands
-            printf( "\nFinished constructing loop block? (y/n) " );
-            char ans[255];
-            // Check input and verify its validity
-            if( fgets(ans, 255, input) != NULL && ans[0] == 'y' && strlen(ans) == 2 ) {
-                break;
-            }
-        }
-        // Set to repeat
-        fprintf( session, "} repeat\n" );
+    // Check if we have the correct number of arguments
+    if( node->argc != 2 ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\tlinewidth <width>\n" );
+        return;
+    }
+
+    double width;
+    if( !numArg( argv[1], &width ) ) {
+        printf( "\nERROR:\tArguments must be numbers!\n" );
+        return;
+    }
+    if( width < 0 ) {
+        printf( "\nERROR:\tLine width must not be negative!\n" );
+        return;
+    }
 
-        printf( "Loop block finished. Result of block will be looped %d times.\n", count );
+    GState* pending = gstatePending();
+    if( paramRef( argv[1] ) ) {
+        // Parameters are only known when the procedure runs
+        writeArg( argv[1], width );
+        writerPrintf( session, " setlinewidth\n" );
+        pending->known &= ~GS_LINE_WIDTH;
+        gstateForget( GS_LINE_WIDTH );
+        compiling->styled = true;
+    } else {
+        pending->lineWidth = width;
+        pending->known |= GS_LINE_WIDTH;
     }
 }
 
 /*
- * Opens and evaluates a script file that conforms to this interpreter.
+ * Command state to set the dash pattern of subsequent shapes.
  *
  * Input:
- * char* filename - Name of the script file to open.
+ * float lengths[] - (optional) Alternating lengths of dashes and gaps. If none
+ *                              are given, lines are solid.
  */
-void open( int argc, char* argv[] ) {
+void dash( Node* node ) {
+    int argc = node->argc;
+    char** argv = node->argv;
+
     // Check if we have the correct number of arguments
-    if( argc != 2 ) {
+    if( argc - 1 > MAX_DASH ) {
         printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\topen <filename>\n" );
-    } else {
-        // Check the file extension of the file
-        char* extension = index( argv[1], '.' );
-        if( extension == NULL || strcmp(extension, ".pscript") != 0 ) {
-            printf( "\nERROR:\tUnsuppored filetype! Expected '.pscript' file!\n" );
+        printf( "Usage:\tdash [lengths...] (up to %d)\n", MAX_DASH );
+        return;
+    }
+
+    double lengths[MAX_DASH];
+    bool symbolic = false;
+    bool visible = false;
+    for( int i = 1; i < argc; i++ ) {
+        if( !numArg( argv[i], &lengths[i - 1] ) ) {
+            printf( "\nERROR:\tArguments must be numbers!\n" );
             return;
         }
+        if( lengths[i - 1] < 0 ) {
+            printf( "\nERROR:\tDash lengths must not be negative!\n" );
+            return;
+        }
+        symbolic = symbolic || paramRef( argv[i] );
+        visible = visible || lengths[i - 1] > 0;
+    }
+
+    // PostScript rejects patterns that are all zero
+    if( argc > 1 && !visible && !symbolic ) {
+        printf( "\nERROR:\tDash lengths must not all be zero!\n" );
+        return;
+    }
 
-        // Close the session first
-        if( session != NULL ) {
-            printf( "Closing current session before loading script.\n" );
-            end( 1, NULL );
+    GState* pending = gstatePending();
+    if(symbolic) {
+        // Parameters are only known when the procedure runs
+        writerPrintf( session, "[" );
+        for( int i = 1; i < argc; i++ ) {
+            writerPrintf( session, i > 1 ? " " : "" );
+            writeArg( argv[i], lengths[i - 1] );
         }
+        writerPrintf( session, "] 0 setdash\n" );
+        pending->known &= ~GS_DASH;
+        gstateForget( GS_DASH );
+        compiling->styled = true;
+    } else {
+        pending->dashCount = argc - 1;
+        memcpy( pending->dash, lengths, (argc - 1) * sizeof(double) );
+        pending->known |= GS_DASH;
+    }
+}
 
-        // Open the file
-        FILE* script = fopen( argv[1], "r" );
+/*
+ * Opens and evaluates a script file that conforms to this interpreter. The
+ * whole script is parsed before any of it is executed.
+ *
+ * Input:
+ * char* filename - Name of the script file to open.
+ */
+void openScript( Node* node ) {
+    // Check if we have the correct number of arguments
+    if( node->argc != 2 ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\topen <filename>\n" );
+        return;
+    }
 
-        // Check if open succeeded
-        if( script == NULL ) {
-            printf( "\nERROR:\tFailed to open script file!\n" );
-            return;
-        } else {
-            printf( "\nExecuting user-defined script file: %s\n\n", argv[1] );
+    char* filename = node->argv[1];
+
+    // Check the file extension of the file
+    char* extension = rindex( filename, '.' );
+    if( extension == NULL || strcmp(extension, ".pscript") != 0 ) {
+        printf( "\nERROR:\tUnsuppored filetype! Expected '.pscript' file!\n" );
+        return;
+    }
+
+    // Open the file
+    FILE* script = fopen( filename, "r" );
+
+    // Check if open succeeded
+    if( script == NULL ) {
+        printf( "\nERROR:\tFailed to open script file!\n" );
+        return;
+    }
 
-            // Evaluate the script
-            while( !feof(script) ) {
-                eval(script, false);
+    // Parse the whole script
+    Parser parser;
+    parserInit( &parser, script, filename, false );
+    Node* nodes = parseScript( &parser );
+    fclose(script);
+
+    // Move the interpreter's output off of stdout before any more is
+    // printed, if the script streams a session to it
+    if( !parser.failed && streamsToStdout( nodes ) ) {
+        claimStream();
+    }
+    printInfo();
+    if( parser.failed ) {
+        printf( "\nERROR:\tScript not executed due to errors!\n" );
+        return;
+    }
+
+    // Close the session first
+    char* endArgs[1] = { "end" };
+    Node endNode = { .argc = 1, .argv = endArgs };
+    if( session != NULL ) {
+        printf( "Closing current session before loading script.\n" );
+        end( &endNode );
+    }
+
+    printf( "\nExecuting user-defined script file: %s\n\n", filename );
+
+    // Execute the script. With --jobs, independent shapes are generated on
+    // worker threads, and merged into the session in order with everything
+    // else, which is executed here. With --watch, their output is kept so it
+    // can be reused when the script is run again.
+    bool wasInteractive = interactive;
+    interactive = false;
+    ShapeJob* job = NULL;
+    for( Node* command = nodes; command != NULL && !quitting; command = command->next ) {
+        bool shape = (options.jobs > 1 || options.watch) && !options.cull && !options.instance
+                     && session != NULL && independent( command );
+        if( shape && options.jobs > 1 ) {
+            if( job != NULL ) {
+                job->count++;
+            } else {
+                startPool();
+                job = pool != NULL ? (ShapeJob*)malloc(sizeof(ShapeJob)) : NULL;
+                if( job != NULL ) {
+                    // The style is written before the shapes, as in beginShape
+                    backend->sync( session, GS_ALL );
+                    poolWrite( pool, session );
+
+                    job->node = command;
+                    job->count = 1;
+                    job->pending = *gstatePending();
+                    job->current = gstateCurrent();
+                }
+            }
+            if( job != NULL ) {
+                if( job->count == JOB_SHAPES ) {
+                    poolSubmit( pool, generateShape, job );
+                    job = NULL;
+                }
+                continue;
             }
+        }
 
-            // Close the file
-            fclose(script);
+        // Everything else is executed here, after the shapes before it
+        if( job != NULL ) {
+            poolSubmit( pool, generateShape, job );
+            job = NULL;
         }
+        int index = findCommand( command->argv[0] );
+        if( index >= 0 && index < PS_CMD_START ) {
+            // Control commands need the session itself
+            stopPool();
+        }
+        if(shape) {
+            generate( command );
+        } else {
+            execute( command, false );
+        }
+    }
+    if( job != NULL ) {
+        poolSubmit( pool, generateShape, job );
     }
+    stopPool();
+    interactive = wasInteractive;
+
+    freeNodes(nodes);
 }
 
 /*
- * Command state to quit the program.
+ * Command state to define a macro. The body is compiled into a PostScript
+ * procedure in each session it is used in.
  *
  * Input:
- * None
+ * char* name     - The name of the macro.
+ * char* params[] - (optional) The names of the macro's parameters.
+ * Node* body     - The commands in the macro.
  */
-void quit( int argc, char* argv[] ) {
+void define( Node* node ) {
+    int argc = node->argc;
+    char** argv = node->argv;
+
     // Check if we have the correct number of arguments
-    if( argc < 1 || argc > 2 ) {
+    if( argc < 2 || argc - 2 > MAX_MACRO_PARAMS ) {
         printf( "\nERROR:\tInvalid number of arguments provided!\n" );
-        printf( "Usage:\tquit\n" );
-    } else {
-        // Close the session first
-        if( session != NULL ) {
-            end( 1, NULL );
+        printf( "Usage:\tdefine <name> [params...] { ... }\n" );
+        return;
+    }
+
+    // Macros may not shadow the built in commands
+    for( int i = 0; i < NUM_COMMANDS; i++ ) {
+        if( strcmp( commands[i], argv[1] ) == 0 ) {
+            printf( "\nERROR:\tCannot redefine built in command '%s'!\n", argv[1] );
+            return;
         }
+    }
+
+    // The names are written into the procedure's PostScript names
+    if( !psName( argv[1] ) ) {
+        printf( "\nERROR:\tInvalid macro name '%s'!\n", argv[1] );
+        return;
+    }
 
-        // Get the script setting arg
-        int script = 0;
-        if( argc == 2 ) {
-            script = atoi(argv[1]);
+    // Parameter names must not look like numbers, or arguments would be
+    // ambiguous in the body
+    for( int i = 2; i < argc; i++ ) {
+        if( (argv[i][0] >= '0' && argv[i][0] <= '9') || argv[i][0] == '-'
+            || argv[i][0] == '+' || argv[i][0] == '.' || !psName( argv[i] ) ) {
+            printf( "\nERROR:\tInvalid parameter name '%s'!\n", argv[i] );
+            return;
         }
+    }
 
-        // Free the args value for this call
-        if(!script) {
-            free(argv[0]);
+    // Replace any existing macro of the same name
+    Macro* macro = findMacro( argv[1] );
+    if( macro == NULL ) {
+        macro = (Macro*)malloc(sizeof(Macro));
+        if( macro == NULL ) {
+            printf( "\nERROR:\tFailed to allocate macro!\n" );
+            return;
+        }
+        macro->name = strdup( argv[1] );
+        macro->next = macros;
+        macros = macro;
+    } else {
+        for( int i = 0; i < macro->paramc; i++ ) {
+            free( macro->params[i] );
         }
+        freeNodes( macro->body );
+    }
+
+    macro->paramc = argc - 2;
+    for( int i = 0; i < macro->paramc; i++ ) {
+        macro->params[i] = strdup( argv[i + 2] );
+    }
+
+    // Take the body from the command, so it outlives it
+    macro->body = node->body;
+    node->body = NULL;
+
+    // Compile the macro now if there is a session to compile it into
+    if( session != NULL ) {
+        compileMacro( macro );
+    }
+
+    printf( "Macro '%s' defined.\n", argv[1] );
+}
+
+/*
+ * Command state to define a pattern that shapes may be filled with. The body
+ * draws a single tile, which is repeated across the shape. The pattern is
+ * compiled into each session it is used in.
+ *
+ * Input:
+ * char* name    - The name of the pattern.
+ * float width   - The width of a tile.
+ * float height  - The height of a tile.
+ * Node* body    - The commands drawing a tile, from (0,0) to (width,height).
+ */
+void definePattern( Node* node ) {
+    char** argv = node->argv;
+
+    // Check if we have the correct number of arguments
+    if( node->argc != 4 ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\tpattern <name> <width> <height> { ... }\n" );
+        return;
+    }
+
+    // The name is written into the pattern's PostScript name
+    if( !psName( argv[1] ) ) {
+        printf( "\nERROR:\tInvalid pattern name '%s'!\n", argv[1] );
+        return;
+    }
 
-        printf( "Closing interpreter...\n" );
+    double width, height;
+    if( !parseNumber( argv[2], &width ) || !parseNumber( argv[3], &height ) ) {
+        printf( "\nERROR:\tArguments must be numbers!\n" );
+        return;
+    }
+    if( width <= 0 || height <= 0 ) {
+        printf( "\nERROR:\tThe size of a pattern must be positive!\n" );
+        return;
+    }
 
-        // Close the input stream
-        if(!script) {
-            fclose(input);
+    // Replace any existing pattern of the same name
+    Pattern* tile = findPattern( argv[1] );
+    if( tile == NULL ) {
+        tile = (Pattern*)malloc(sizeof(Pattern));
+        if( tile == NULL ) {
+            printf( "\nERROR:\tFailed to allocate pattern!\n" );
+            return;
         }
+        tile->name = strdup( argv[1] );
+        tile->next = patterns;
+        patterns = tile;
+    } else {
+        freeNodes( tile->body );
+    }
+    tile->width = width;
+    tile->height = height;
+
+    // Take the body from the command, so it outlives it
+    tile->body = node->body;
+    node->body = NULL;
+
+    // Compile the pattern now if there is a session to compile it into
+    if( session != NULL ) {
+        compilePattern( tile );
+    }
+
+    printf( "Pattern '%s' defined.\n", argv[1] );
+}
+
+/*
+ * Command state to quit the program.
+ *
+ * Input:
+ * None
+ */
+void quit( Node* node ) {
+    // Check if we have the correct number of arguments
+    if( node->argc != 1 ) {
+        printf( "\nERROR:\tInvalid number of arguments provided!\n" );
+        printf( "Usage:\tquit\n" );
+        return;
+    }
 
-        // Exit the program successfully
-        exit(EXIT_SUCCESS);
+    // Close the session first
+    if( session != NULL ) {
+        char* endArgs[1] = { "end" };
+        Node endNode = { .argc = 1, .argv = endArgs };
+        end( &endNode );
     }
+
+    // When watching a script, quitting only ends the current run
+    if( options.watch ) {
+        quitting = true;
+        return;
+    }
+
+    printf( "Closing interpreter...\n" );
+
+    // Exit the program successfully
+    exit(EXIT_SUCCESS);
 }
 
 /*
@@ -1004,45 +3554,66 @@ void quit( int argc, char* argv[] ) {
  * Input:
  * None
  */
-void help( int argc, char* argv[] ) {
+void help( Node* node ) {
     // Check if we have the correct number of arguments
-    if( argc != 1 ) {
+    if( node->argc != 1 ) {
         printf( "\nERROR:\tInvalid number of arguments provided!\n" );
         printf( "Usage:\thelp\n" );
-    } else {
-        printf( "\nPostGen Manual\n" );
-        printf( "--------------\n" );
-        printf( "This interpreter behaves like a state machine, with each \n"
-                "command mapped to its own state.  The commands given construct \n"
-                "a PostScript file that can be opened in any PostScript viewer. \n"
-                "Prior to executing any commands, a session must first be created \n"
-                "which sets up the PostScript file that is being constructed.\n" );
-        printf( "\nCommands:" );
-        printf( "\nbegin [name]                         \tStarts a new session with the given name.\n" );
-        printf( "                                       \tThis creates a PostScript file of the given name.\n" );
-        printf( "\nend                                  \tEnds the current session and closes its file.\n" );
-        printf( "\npath [x] [y]                         \tConstructs a user-defined, open path, starting at (x,y).\n"
-                "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
-        printf( "\nclosedpath [x] [y]                   \tConstructs a user-defined, closed path, starting at (x,y).\n"
-                "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
-        printf( "\nsolidpath [x] [y]                    \tConstructs a user-defined, filled path, starting at (x,y).\n"
-                "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
-        printf( "\ncurve [x] [y]                        \tConstructs a user-defined, bezier curve, starting at (x,y).\n"
-                "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
-        printf( "\nclosedcurve [x] [y]                  \tConstructs a user-defined, closed bezier curve, starting at (x,y).\n"
-                "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
-        printf( "\nsolidcurve [x] [y]                   \tConstructs a user-defined, filled bezier curve, starting at (x,y).\n"
-                "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
-        printf( "\ncircle [x] [y] [radius]              \tConstructs a circle with center at (x,y) and the given radius.\n" );
-        printf( "\nsolidcircle [x] [y] [radius]         \tConstructs a filled circle with center at (x,y), and the given radius.\n" );
-        printf( "\npolygon [x] [y] [radius] [sides]     \tConstructs an n-sided polygon centered at (x,y).\n"
-                "                                       \tPolygon has given radius and number of sides.\n" );
-        printf( "\nsolidpolygon [x] [y] [radius] [sides]\tConstructs a filled n-sided polygon centered at (x,y).\n"
-                "                                       \tPolygon has given radius and number of sides.\n" );
-        printf( "\nrotate [degrees]                     \tRotates the given construct by the given number of degrees.\n" );
-        printf( "\nloop [count]                         \tRepeats the given construct count times.\n" );
-        printf( "\nopen [filename]                      \tOpens the given script file and evaluates it.\n ");
-        printf( "\nquit                                 \tCloses any open session and exits the interpreter.\n" );
-        printf( "\nhelp                                 \tDisplays this dialog.\n" );
+        return;
     }
+
+    printf( "\nPostGen Manual\n" );
+    printf( "--------------\n" );
+    printf( "This interpreter behaves like a state machine, with each \n"
+            "command mapped to its own state.  The commands given construct \n"
+            "a PostScript file that can be opened in any PostScript viewer. \n"
+            "Prior to executing any commands, a session must first be created \n"
+            "which sets up the PostScript file that is being constructed.\n" );
+    printf( "\nBlocks of commands are given between '{' at the end of the line and a\n"
+            "closing '}' line. Interactively, blocks may also be entered one command\n"
+            "at a time, answering whether the block is finished after each.\n" );
+    printf( "\nCommands:" );
+    printf( "\nbegin [name]                         \tStarts a new session with the given name.\n" );
+    printf( "                                       \tThis creates a PostScript file of the given name.\n" );
+    printf( "                                       \tIf the name is '-', the session is streamed to stdout.\n" );
+    printf( "\nend                                  \tEnds the current session and closes its file.\n" );
+    printf( "\npath [x] [y]                         \tConstructs a user-defined, open path, starting at (x,y).\n"
+            "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
+    printf( "\nclosedpath [x] [y]                   \tConstructs a user-defined, closed path, starting at (x,y).\n"
+            "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
+    printf( "\nsolidpath [x] [y]                    \tConstructs a user-defined, filled path, starting at (x,y).\n"
+            "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
+    printf( "\ncurve [x] [y]                        \tConstructs a user-defined, bezier curve, starting at (x,y).\n"
+            "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
+    printf( "\nclosedcurve [x] [y]                  \tConstructs a user-defined, closed bezier curve, starting at (x,y).\n"
+            "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
+    printf( "\nsolidcurve [x] [y]                   \tConstructs a user-defined, filled bezier curve, starting at (x,y).\n"
+            "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
+    printf( "\ncircle [x] [y] [radius]              \tConstructs a circle with center at (x,y) and the given radius.\n" );
+    printf( "\nsolidcircle [x] [y] [radius]         \tConstructs a filled circle with center at (x,y), and the given radius.\n" );
+    printf( "\npolygon [x] [y] [radius] [sides]     \tConstructs an n-sided polygon centered at (x,y).\n"
+            "                                       \tPolygon has given radius and number of sides.\n" );
+    printf( "\nsolidpolygon [x] [y] [radius] [sides]\tConstructs a filled n-sided polygon centered at (x,y).\n"
+            "                                       \tPolygon has given radius and number of sides.\n" );
+    printf( "\npatternpath [name] [x] [y]           \tConstructs a user-defined path filled with the given pattern.\n"
+            "                                       \tContinues to read tuples in until the user enters 'done'.\n" );
+    printf( "\npatterncircle [name] [x] [y] [radius]\tConstructs a circle filled with the given pattern.\n" );
+    printf( "\npatternpolygon [name] [x] [y] [r] [n]\tConstructs an n-sided polygon filled with the given pattern.\n" );
+    printf( "\nimage [file] [x] [y] [w] [h]         \tDraws a binary (P6) PPM or (P5) PGM image in the w by h\n"
+            "                                       \trectangle at (x,y). ASCII (P3/P2) files aren't accepted.\n" );
+    printf( "\ntext [font] [size] [x] [y] [string]  \tWrites the rest of the line at (x,y) in the given font and size.\n" );
+    printf( "\nimport [filename]                    \tDraws the paths, circles and polygons of an SVG file. A file\n"
+            "                                       \twith neither a viewBox nor a height is flipped within a\n"
+            "                                       \tUS Letter page (792 high).\n" );
+    printf( "\nrotate [degrees] { ... }             \tRotates the given block by the given number of degrees.\n" );
+    printf( "\nloop [count] { ... }                 \tRepeats the given block count times.\n" );
+    printf( "\ncolor [r] [g] [b]                    \tSets the color of subsequent shapes (components from 0 to 1).\n" );
+    printf( "\nlinewidth [width]                    \tSets the line width of subsequent shapes.\n" );
+    printf( "\ndash [lengths...]                    \tSets the dash pattern of subsequent shapes.\n"
+            "                                       \tWith no lengths, lines are solid.\n" );
+    printf( "\nopen [filename]                      \tOpens the given script file and evaluates it.\n ");
+    printf( "\ndefine [name] [params...] { ... }    \tDefines a macro invoked as '[name] [args...]'.\n" );
+    printf( "\npattern [name] [w] [h] { ... }       \tDefines a pattern, whose block draws one w by h tile.\n" );
+    printf( "\nquit                                 \tCloses any open session and exits the interpreter.\n" );
+    printf( "\nhelp                                 \tDisplays this dialog.\n" );
 }
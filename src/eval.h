@@ -6,9 +6,46 @@
 #ifndef EVAL_H
 #define EVAL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "backend.h"
+
+// Options that control how sessions are generated
+typedef struct Options {
+    // Write session files in the background, so the interpreter isn't
+    // blocked by slow destinations
+    bool asyncOutput;
+    // Stream every session to this descriptor rather than a file, or -1
+    int outputFd;
+    // Write the bodies of loop and rotate blocks as forms where possible
+    bool forms;
+    // Leave out shapes that are hidden under later fills
+    bool cull;
+    // Write the points of paths relative to each other
+    bool relative;
+    // The number of threads shapes are generated on
+    int jobs;
+    // Evaluate loop and rotate blocks, writing plain paths rather than
+    // procedures, for loops estimated to expand to at most flattenBudget bytes
+    bool flatten;
+    size_t flattenBudget;
+    // Define shapes that are drawn repeatedly as procedures, and draw them by
+    // calling the procedure at each position
+    bool instance;
+    // Run the script again whenever it changes, reusing the output of the
+    // shapes that haven't changed
+    bool watch;
+    // The format sessions are written in
+    const Backend* backend;
+    // Count what the RIP does to render each session, and report the lines
+    // that cost the most, rather than writing anything
+    bool analyze;
+} Options;
+
 // Public function prototypes:
 
 // Starts the main interpreter loop
-void run(char* filename);
+void run(char* filename, const char* version, const Options* options);
 
 #endif
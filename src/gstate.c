@@ -0,0 +1,293 @@
+/* PostGen Graphics State
+ *
+ * Style commands don't write anything themselves. Instead they change the
+ * pending state, and whenever a shape is painted the parts of the pending
+ * state it uses are compared against the state in effect in the generated
+ * file. Only the parts that differ are written, so setting the same style for
+ * every shape costs nothing.
+ *
+ * The state in effect is kept as a stack that mirrors the gsave/grestore
+ * nesting of the generated file, so a grestore correctly brings back the
+ * state that was saved. Parts of the state can also be unknown, such as at the
+ * start of a macro procedure, which may be invoked in any state; unknown parts
+ * are always written when they are needed.
+ *
+ * Tracking is per thread, so that a shape can be generated on another thread
+ * starting from a copy of the state.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "gstate.h"
+#include "number.h"
+
+// The state PostScript starts each page with
+static const GState initial =
+        {
+            .known = GS_ALL,
+            .color = { 0, 0, 0 },
+            .lineWidth = 1,
+            .dashCount = 0
+        };
+
+// The state requested by the script
+static _Thread_local GState pending;
+
+// The states in effect, one per level of gsave nesting
+static _Thread_local GState stack[MAX_GSTATE_DEPTH];
+static _Thread_local int depth = 0;
+
+// Levels of gsave nesting beyond what is tracked
+static _Thread_local int overflow = 0;
+
+// The number of state changes written
+static _Thread_local unsigned long changes = 0;
+
+// Private function prototypes:
+
+static bool same( const GState* a, const GState* b, unsigned part );
+static void writePart( Writer* out, const GState* state, unsigned part );
+
+/*
+ * Resets tracking for a new session. The requested state and the state in
+ * effect both become PostScript's initial state.
+ */
+void gstateReset( void ) {
+    pending = initial;
+    stack[0] = initial;
+    depth = 0;
+    overflow = 0;
+}
+
+/*
+ * Starts tracking from a copy of another thread's state.
+ *
+ * Input:
+ * const GState* requested - The state requested by the script.
+ * const GState* current   - The state in effect, from gstateCurrent.
+ */
+void gstateLoad( const GState* requested, const GState* current ) {
+    pending = *requested;
+    stack[0] = *current;
+    depth = 0;
+    overflow = 0;
+}
+
+/*
+ * Gets the state PostScript starts each page with.
+ *
+ * Returns:
+ * The initial state.
+ */
+GState gstateInitial( void ) {
+    return initial;
+}
+
+/*
+ * Gets the state requested by the script. Style commands modify this, and it
+ * is applied the next time a shape is painted.
+ *
+ * Returns:
+ * The requested state.
+ */
+GState* gstatePending( void ) {
+    return &pending;
+}
+
+/*
+ * Gets the state in effect in the generated file.
+ *
+ * Returns:
+ * A copy of the state in effect.
+ */
+GState gstateCurrent( void ) {
+    GState current = stack[depth];
+    if( overflow > 0 ) {
+        current.known = 0;
+    }
+
+    return current;
+}
+
+/*
+ * Mirrors a gsave in the generated file.
+ */
+void gstatePush( void ) {
+    if( depth + 1 < MAX_GSTATE_DEPTH ) {
+        stack[depth + 1] = stack[depth];
+        depth++;
+    } else {
+        overflow++;
+    }
+}
+
+/*
+ * Mirrors a grestore in the generated file.
+ */
+void gstatePop( void ) {
+    if( overflow > 0 ) {
+        overflow--;
+    } else if( depth > 0 ) {
+        depth--;
+    }
+}
+
+/*
+ * Marks parts of the state in effect as unknown, such as after running a
+ * procedure that may have changed them.
+ *
+ * Input:
+ * unsigned parts - The parts that are no longer known.
+ */
+void gstateForget( unsigned parts ) {
+    if( overflow == 0 ) {
+        stack[depth].known &= ~parts;
+    }
+}
+
+/*
+ * Writes the given parts of the requested state that differ from the state in
+ * effect, making them the state in effect. Parts of the requested state that
+ * are unknown are left as they are.
+ *
+ * Input:
+ * Writer* out    - Where to write the changes.
+ * unsigned parts - The parts of the state that are about to be used.
+ *
+ * Returns:
+ * True if anything was written.
+ */
+bool gstateSync( Writer* out, unsigned parts ) {
+    GState current = gstateCurrent();
+    bool wrote = false;
+
+    for( unsigned part = GS_COLOR; part <= GS_DASH; part <<= 1 ) {
+        if( (parts & part) && (pending.known & part) && !same( &pending, &current, part ) ) {
+            writePart( out, &pending, part );
+            wrote = true;
+        }
+    }
+
+    return wrote;
+}
+
+/*
+ * Writes whatever is needed to return the state in effect to an earlier one,
+ * for example so that each iteration of a loop starts in the same state. Parts
+ * that were unknown in the earlier state are left as they are, but are unknown
+ * afterwards.
+ *
+ * Input:
+ * Writer* out         - Where to write the changes.
+ * const GState* saved - The earlier state, from gstateCurrent.
+ */
+void gstateRevert( Writer* out, const GState* saved ) {
+    GState current = gstateCurrent();
+
+    for( unsigned part = GS_COLOR; part <= GS_DASH; part <<= 1 ) {
+        if( (saved->known & part) && !same( saved, &current, part ) ) {
+            writePart( out, saved, part );
+        }
+    }
+
+    if( overflow == 0 ) {
+        stack[depth] = *saved;
+    }
+}
+
+/*
+ * Gets the number of state changes written so far this run.
+ *
+ * Returns:
+ * The number of changes.
+ */
+unsigned long gstateChanges( void ) {
+    return changes;
+}
+
+/*
+ * Compares a part of two states. A part that is unknown in either state is
+ * never the same.
+ *
+ * Input:
+ * const GState* a, b - The states to compare.
+ * unsigned part      - The part to compare.
+ *
+ * Returns:
+ * True if the part is known and equal in both states.
+ */
+bool same( const GState* a, const GState* b, unsigned part ) {
+    if( !(a->known & part) || !(b->known & part) ) {
+        return false;
+    }
+
+    switch(part) {
+        case GS_COLOR:
+            return a->color[0] == b->color[0] && a->color[1] == b->color[1]
+                   && a->color[2] == b->color[2];
+        case GS_LINE_WIDTH:
+            return a->lineWidth == b->lineWidth;
+        default:
+            return a->dashCount == b->dashCount
+                   && memcmp( a->dash, b->dash, a->dashCount * sizeof(double) ) == 0;
+    }
+}
+
+/*
+ * Writes a part of a state, making it the state in effect.
+ *
+ * Input:
+ * Writer* out         - Where to write the part.
+ * const GState* state - The state to take the part from.
+ * unsigned part       - The part to write.
+ */
+void writePart( Writer* out, const GState* state, unsigned part ) {
+    char buf[NUMBER_BUF_SIZE];
+
+    switch(part) {
+        case GS_COLOR:
+            for( int i = 0; i < 3; i++ ) {
+                writerWrite( out, buf, formatNumber( buf, state->color[i] ) );
+                writerWrite( out, " ", 1 );
+            }
+            writerPrintf( out, "setrgbcolor\n" );
+            break;
+        case GS_LINE_WIDTH:
+            writerWrite( out, buf, formatNumber( buf, state->lineWidth ) );
+            writerPrintf( out, " setlinewidth\n" );
+            break;
+        default:
+            writerWrite( out, "[", 1 );
+            for( int i = 0; i < state->dashCount; i++ ) {
+                if( i > 0 ) {
+                    writerWrite( out, " ", 1 );
+                }
+                writerWrite( out, buf, formatNumber( buf, state->dash[i] ) );
+            }
+            writerPrintf( out, "] 0 setdash\n" );
+            break;
+    }
+
+    changes++;
+
+    // This is now the state in effect, unless it is nested too deep to track
+    if( overflow > 0 ) {
+        return;
+    }
+    GState* current = &stack[depth];
+    switch(part) {
+        case GS_COLOR:
+            memcpy( current->color, state->color, sizeof(current->color) );
+            break;
+        case GS_LINE_WIDTH:
+            current->lineWidth = state->lineWidth;
+            break;
+        default:
+            current->dashCount = state->dashCount;
+            memcpy( current->dash, state->dash, sizeof(current->dash) );
+            break;
+    }
+    current->known |= part;
+}
@@ -0,0 +1,70 @@
+/* PostGen Graphics State
+ *
+ * Tracks the color, line width and dash of a session so that they are only
+ * written when they actually change.
+ */
+
+#ifndef GSTATE_H
+#define GSTATE_H
+
+#include <stdbool.h>
+
+#include "writer.h"
+
+// The parts of the graphics state that are tracked
+#define GS_COLOR      0x1
+#define GS_LINE_WIDTH 0x2
+#define GS_DASH       0x4
+#define GS_ALL        (GS_COLOR | GS_LINE_WIDTH | GS_DASH)
+
+// The most lengths a dash pattern may have
+#define MAX_DASH 8
+
+// The deepest gsave nesting that is tracked
+#define MAX_GSTATE_DEPTH 64
+
+// A graphics state. Parts that aren't known are left out of 'known'.
+typedef struct GState {
+    unsigned known;
+    double color[3];
+    double lineWidth;
+    int dashCount;
+    double dash[MAX_DASH];
+} GState;
+
+// Public function prototypes:
+
+// Resets tracking for a new session
+void gstateReset( void );
+
+// Starts tracking from a copy of another thread's state
+void gstateLoad( const GState* requested, const GState* current );
+
+// Gets the state PostScript starts each page with
+GState gstateInitial( void );
+
+// Gets the state requested by the script, applied at the next paint
+GState* gstatePending( void );
+
+// Gets the state in effect in the generated file
+GState gstateCurrent( void );
+
+// Mirrors a gsave in the generated file
+void gstatePush( void );
+
+// Mirrors a grestore in the generated file
+void gstatePop( void );
+
+// Marks parts of the state in effect as unknown
+void gstateForget( unsigned parts );
+
+// Writes any of the given parts of the requested state that differ
+bool gstateSync( Writer* out, unsigned parts );
+
+// Writes whatever is needed to return to an earlier state
+void gstateRevert( Writer* out, const GState* saved );
+
+// Gets the number of state changes written so far
+unsigned long gstateChanges( void );
+
+#endif
@@ -0,0 +1,336 @@
+/* PostGen Images
+ *
+ * Images are memory-mapped rather than read, and their samples are encoded
+ * straight from the mapping into the session a line at a time, so the memory
+ * used doesn't depend on the size of the image. The kernel is told the
+ * mapping is read in order, so it reads ahead, and the pages that have been
+ * encoded are dropped as it goes.
+ *
+ * Run-length encoding follows the RunLengthDecode filter: a length byte of 0
+ * to 127 is followed by that many plus one literal bytes, a length byte of
+ * 129 to 255 by a single byte repeated 257 minus that many times, and 128
+ * ends the data.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image.h"
+
+// The number of characters on each line of ASCII85
+#define ASCII85_LINE 75
+
+// The longest run or literal in run-length encoding
+#define RLE_MAX 128
+
+// How many bytes of the image to encode between dropping the pages encoded
+#define RELEASE_BYTES (1 << 20)
+
+// Encodes the samples of an image as ASCII85 into a writer, or only counts
+// them if there is no writer
+typedef struct Encoder {
+    const Image* image;
+    // The length of the mapping that has been dropped
+    size_t released;
+    Writer* out;
+    size_t count;
+    unsigned char group[4];
+    int filled;
+    char line[ASCII85_LINE + 6];
+    int column;
+} Encoder;
+
+// Private function prototypes:
+
+static const unsigned char* readHeader( const unsigned char* at, const unsigned char* end, long* value );
+static void encode( Encoder* encoder, const unsigned char* data, size_t length );
+static void encodeGroup( Encoder* encoder, int length );
+static void finish( Encoder* encoder );
+static void runLength( Encoder* encoder );
+static void release( Encoder* encoder, const unsigned char* before );
+
+/*
+ * Opens a binary PPM (P6) or PGM (P5) image, with up to 8 bits per sample.
+ *
+ * Input:
+ * Image* image         - Used to return the image.
+ * const char* filename - The file to open.
+ *
+ * Returns:
+ * NULL if the image was opened, or a description of why it couldn't be.
+ */
+const char* imageOpen( Image* image, const char* filename ) {
+    int fd = open( filename, O_RDONLY );
+    if( fd < 0 ) {
+        return "Failed to open image file";
+    }
+
+    struct stat info;
+    if( fstat( fd, &info ) < 0 || info.st_size == 0 ) {
+        close(fd);
+        return "Failed to open image file";
+    }
+
+    image->mapLength = info.st_size;
+    image->map = mmap( NULL, image->mapLength, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close(fd);
+    if( image->map == MAP_FAILED ) {
+        return "Failed to map image file";
+    }
+    madvise( image->map, image->mapLength, MADV_SEQUENTIAL );
+
+    // The header is the magic number, width, height and maximum value,
+    // separated by whitespace or comments, and a single whitespace character
+    const unsigned char* at = (const unsigned char*)image->map;
+    const unsigned char* end = at + image->mapLength;
+    long width, height, maxval;
+    if( image->mapLength < 2 || at[0] != 'P' || (at[1] != '5' && at[1] != '6') ) {
+        imageClose(image);
+        return "Unsupported image format! Expected a binary PPM or PGM image";
+    }
+    image->components = at[1] == '6' ? 3 : 1;
+    at += 2;
+    if( (at = readHeader( at, end, &width )) == NULL || (at = readHeader( at, end, &height )) == NULL
+        || (at = readHeader( at, end, &maxval )) == NULL || at == end ) {
+        imageClose(image);
+        return "Invalid image header";
+    }
+    at++;
+
+    if( width < 1 || height < 1 || width > INT32_MAX || height > INT32_MAX ) {
+        imageClose(image);
+        return "Invalid image size";
+    }
+    if( maxval < 1 || maxval > 255 ) {
+        imageClose(image);
+        return "Unsupported image depth! Expected at most 8 bits per sample";
+    }
+
+    image->width = width;
+    image->height = height;
+    image->maxval = maxval;
+    image->pixels = at;
+    image->length = (size_t)width * height * image->components;
+    if( image->length / height / image->components != (size_t)width || image->length > (size_t)(end - at) ) {
+        imageClose(image);
+        return "Image file is truncated";
+    }
+
+    return NULL;
+}
+
+/*
+ * Gets the length of the samples of an image once run-length encoded, which
+ * is only worth doing if it's shorter than the samples themselves.
+ *
+ * Input:
+ * const Image* image - The image.
+ *
+ * Returns:
+ * The length of the encoded samples.
+ */
+size_t imageRunLength( const Image* image ) {
+    Encoder counter = { .image = image, .out = NULL };
+    runLength( &counter );
+    return counter.count;
+}
+
+/*
+ * Writes the samples of an image as ASCII85, ending with its end of data
+ * marker '~>'.
+ *
+ * Input:
+ * const Image* image - The image.
+ * Writer* out        - Where to write the samples.
+ * bool rle           - Whether to run-length encode the samples first.
+ */
+void imageStream( const Image* image, Writer* out, bool rle ) {
+    Encoder encoder = { .image = image, .out = out };
+    if(rle) {
+        runLength( &encoder );
+    } else {
+        for( size_t i = 0; i < image->length; i += RELEASE_BYTES ) {
+            size_t length = image->length - i < RELEASE_BYTES ? image->length - i : RELEASE_BYTES;
+            encode( &encoder, image->pixels + i, length );
+            release( &encoder, image->pixels + i + length );
+        }
+    }
+    finish( &encoder );
+}
+
+/*
+ * Unmaps an image.
+ *
+ * Input:
+ * Image* image - The image.
+ */
+void imageClose( Image* image ) {
+    munmap( image->map, image->mapLength );
+    image->map = NULL;
+}
+
+/*
+ * Reads a number from the header of an image, skipping whitespace and
+ * comments before it.
+ *
+ * Returns:
+ * The position after the number, or NULL if there isn't one.
+ */
+const unsigned char* readHeader( const unsigned char* at, const unsigned char* end, long* value ) {
+    while( at < end && (*at == ' ' || *at == '\t' || *at == '\r' || *at == '\n' || *at == '#') ) {
+        if( *at == '#' ) {
+            while( at < end && *at != '\n' ) {
+                at++;
+            }
+        } else {
+            at++;
+        }
+    }
+
+    if( at == end || *at < '0' || *at > '9' ) {
+        return NULL;
+    }
+    *value = 0;
+    while( at < end && *at >= '0' && *at <= '9' ) {
+        if( *value > INT32_MAX ) {
+            return NULL;
+        }
+        *value = *value * 10 + (*at - '0');
+        at++;
+    }
+
+    return at;
+}
+
+/*
+ * Adds bytes to the ASCII85 output.
+ */
+void encode( Encoder* encoder, const unsigned char* data, size_t length ) {
+    if( encoder->out == NULL ) {
+        encoder->count += length;
+        return;
+    }
+
+    for( size_t i = 0; i < length; i++ ) {
+        encoder->group[encoder->filled++] = data[i];
+        if( encoder->filled == 4 ) {
+            encodeGroup( encoder, 4 );
+            encoder->filled = 0;
+        }
+    }
+}
+
+/*
+ * Writes a group of up to four bytes as ASCII85. Four zero bytes are written
+ * as 'z', and a final group of fewer bytes as one more character than it has.
+ */
+void encodeGroup( Encoder* encoder, int length ) {
+    uint32_t value = 0;
+    for( int i = 0; i < 4; i++ ) {
+        value = value << 8 | (i < length ? encoder->group[i] : 0);
+    }
+
+    if( value == 0 && length == 4 ) {
+        encoder->line[encoder->column++] = 'z';
+    } else {
+        char digits[5];
+        for( int i = 4; i >= 0; i-- ) {
+            digits[i] = '!' + value % 85;
+            value /= 85;
+        }
+        memcpy( encoder->line + encoder->column, digits, length + 1 );
+        encoder->column += length + 1;
+    }
+
+    if( encoder->column >= ASCII85_LINE ) {
+        encoder->line[encoder->column++] = '\n';
+        writerWrite( encoder->out, encoder->line, encoder->column );
+        encoder->column = 0;
+    }
+}
+
+/*
+ * Writes whatever is left of the ASCII85 output, and its end of data marker.
+ */
+void finish( Encoder* encoder ) {
+    if( encoder->out == NULL ) {
+        return;
+    }
+
+    if( encoder->filled > 0 ) {
+        encodeGroup( encoder, encoder->filled );
+        encoder->filled = 0;
+    }
+    writerWrite( encoder->out, encoder->line, encoder->column );
+    writerWrite( encoder->out, "~>\n", 3 );
+    encoder->column = 0;
+}
+
+/*
+ * Adds the samples to the output, run-length encoded, followed by the end of
+ * data byte. Runs of three or more bytes are repeated, and everything else is
+ * written literally.
+ */
+void runLength( Encoder* encoder ) {
+    const unsigned char* data = encoder->image->pixels;
+    size_t length = encoder->image->length;
+    size_t literal = 0;
+    size_t i = 0;
+    while( i < length ) {
+        size_t run = 1;
+        while( i + run < length && run < RLE_MAX && data[i + run] == data[i] ) {
+            run++;
+        }
+
+        // Flush the literal bytes before a run, or once there are too many
+        if( literal > 0 && (run >= 3 || literal == RLE_MAX) ) {
+            unsigned char header = literal - 1;
+            encode( encoder, &header, 1 );
+            encode( encoder, data + i - literal, literal );
+            literal = 0;
+        }
+
+        if( run >= 3 ) {
+            unsigned char repeat[2] = { 257 - run, data[i] };
+            encode( encoder, repeat, 2 );
+            i += run;
+        } else {
+            literal++;
+            i++;
+        }
+        release( encoder, data + i - literal );
+    }
+
+    if( literal > 0 ) {
+        unsigned char header = literal - 1;
+        encode( encoder, &header, 1 );
+        encode( encoder, data + i - literal, literal );
+    }
+    unsigned char eod = 128;
+    encode( encoder, &eod, 1 );
+}
+
+/*
+ * Drops the pages of the image before a point once enough have been encoded,
+ * so they don't stay in memory. They are read again if they are used again.
+ */
+void release( Encoder* encoder, const unsigned char* before ) {
+    static long pageSize = 0;
+    if( pageSize == 0 ) {
+        pageSize = sysconf(_SC_PAGESIZE);
+    }
+
+    size_t offset = before - (const unsigned char*)encoder->image->map;
+    offset -= offset % pageSize;
+    if( offset >= encoder->released + RELEASE_BYTES ) {
+        madvise( (char*)encoder->image->map + encoder->released, offset - encoder->released, MADV_DONTNEED );
+        encoder->released = offset;
+    }
+}
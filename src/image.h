@@ -0,0 +1,45 @@
+/* PostGen Images
+ *
+ * Provides reading of PPM and PGM images, and streaming their pixels into a
+ * session as ASCII85, optionally run-length encoded.
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "writer.h"
+
+// An image mapped into memory
+typedef struct Image {
+    int width;
+    int height;
+    // 1 for gray, 3 for RGB
+    int components;
+    // The value of a full intensity sample
+    int maxval;
+    // The samples, row by row from the top
+    const unsigned char* pixels;
+    size_t length;
+    // The mapping of the whole file
+    void* map;
+    size_t mapLength;
+} Image;
+
+// Public function prototypes:
+
+// Opens a binary PPM or PGM image
+const char* imageOpen( Image* image, const char* filename );
+
+// Gets the length of the samples once run-length encoded
+size_t imageRunLength( const Image* image );
+
+// Writes the samples as ASCII85, optionally run-length encoded first
+void imageStream( const Image* image, Writer* out, bool rle );
+
+// Unmaps an image
+void imageClose( Image* image );
+
+#endif
@@ -0,0 +1,188 @@
+/* PostGen Instances
+ *
+ * Paths are described by their quantized points relative to their first
+ * point, which leaves out where they are drawn. Each description is kept in a
+ * hash table along with the number of times it has been drawn. The first time
+ * a path is drawn it is written as usual, since it may never be drawn again.
+ * The second time, it is defined as a procedure, which that and every later
+ * time it is drawn is called with the position of the path.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "instance.h"
+
+// The number of buckets the table starts with
+#define INSTANCE_BUCKETS 256
+
+// A shape that has been drawn
+typedef struct Shape {
+    uint64_t hash;
+    bool curve;
+    int count;
+    int64_t* offsets;
+    // The number of the procedure drawing the shape, or 0 if it has only been
+    // drawn once
+    int id;
+    struct Shape* next;
+} Shape;
+
+static Shape** buckets = NULL;
+static size_t bucketCount = 0;
+static size_t shapeCount = 0;
+static InstanceStats stats;
+
+// Private function prototypes:
+
+static uint64_t hashOffsets( const int64_t* points, int count, bool curve );
+static bool sameShape( const Shape* shape, const int64_t* points, int count, bool curve );
+static void grow( void );
+
+/*
+ * Forgets every shape, for a new session, whose file has none of their
+ * procedures.
+ */
+void instanceReset( void ) {
+    for( size_t i = 0; i < bucketCount; i++ ) {
+        while( buckets[i] != NULL ) {
+            Shape* shape = buckets[i];
+            buckets[i] = shape->next;
+            free( shape->offsets );
+            free(shape);
+        }
+    }
+    shapeCount = 0;
+    memset( &stats, 0, sizeof(stats) );
+}
+
+/*
+ * Looks up a path by its shape, ignoring where it is drawn, and records that
+ * it was drawn.
+ *
+ * Input:
+ * const int64_t* points - The points of the path, in steps of the current
+ *                         precision, as pairs of coordinates.
+ * int count             - The number of points.
+ * bool curve            - Whether the path is a curve.
+ * bool* define          - Set if the procedure drawing the shape has to be
+ *                         defined before it is called.
+ *
+ * Returns:
+ * The number of the procedure drawing the shape, or 0 if it hasn't been drawn
+ * before, and so is to be written as usual.
+ */
+int instanceFind( const int64_t* points, int count, bool curve, bool* define ) {
+    uint64_t hash = hashOffsets( points, count, curve );
+    *define = false;
+
+    if( bucketCount > 0 ) {
+        for( Shape* shape = buckets[hash % bucketCount]; shape != NULL; shape = shape->next ) {
+            if( shape->hash == hash && sameShape( shape, points, count, curve ) ) {
+                if( shape->id == 0 ) {
+                    shape->id = ++stats.defined;
+                    *define = true;
+                }
+                stats.instanced++;
+                return shape->id;
+            }
+        }
+    }
+
+    // Shapes that can't be kept are simply written as usual
+    if( shapeCount >= bucketCount ) {
+        grow();
+    }
+    Shape* shape = (Shape*)malloc(sizeof(Shape));
+    int64_t* offsets = (int64_t*)malloc( 2 * count * sizeof(int64_t) );
+    if( bucketCount == 0 || shape == NULL || offsets == NULL ) {
+        free(shape);
+        free(offsets);
+        return 0;
+    }
+
+    for( int i = 0; i < count; i++ ) {
+        offsets[2 * i] = points[2 * i] - points[0];
+        offsets[2 * i + 1] = points[2 * i + 1] - points[1];
+    }
+    shape->hash = hash;
+    shape->curve = curve;
+    shape->count = count;
+    shape->offsets = offsets;
+    shape->id = 0;
+    shape->next = buckets[hash % bucketCount];
+    buckets[hash % bucketCount] = shape;
+    shapeCount++;
+
+    return 0;
+}
+
+/*
+ * Gets the number of shapes drawn as instances in the session.
+ *
+ * Returns:
+ * The number of procedures defined, and the number of times they were called.
+ */
+InstanceStats instanceStats( void ) {
+    return stats;
+}
+
+/*
+ * Hashes the shape of a path with FNV-1a.
+ */
+uint64_t hashOffsets( const int64_t* points, int count, bool curve ) {
+    uint64_t hash = 0xcbf29ce484222325ULL ^ curve;
+    for( int i = 0; i < 2 * count; i++ ) {
+        uint64_t offset = points[i] - points[i % 2];
+        for( int byte = 0; byte < 8; byte++ ) {
+            hash ^= (offset >> (8 * byte)) & 0xff;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+/*
+ * Checks if a path has the shape of one drawn before.
+ */
+bool sameShape( const Shape* shape, const int64_t* points, int count, bool curve ) {
+    if( shape->curve != curve || shape->count != count ) {
+        return false;
+    }
+
+    for( int i = 0; i < 2 * count; i++ ) {
+        if( shape->offsets[i] != points[i] - points[i % 2] ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Doubles the number of buckets, moving every shape to its new bucket. If
+ * there isn't enough memory, the table is left as it is.
+ */
+void grow( void ) {
+    size_t count = bucketCount > 0 ? bucketCount * 2 : INSTANCE_BUCKETS;
+    Shape** grown = (Shape**)calloc( count, sizeof(Shape*) );
+    if( grown == NULL ) {
+        return;
+    }
+
+    for( size_t i = 0; i < bucketCount; i++ ) {
+        Shape* shape = buckets[i];
+        while( shape != NULL ) {
+            Shape* next = shape->next;
+            shape->next = grown[shape->hash % count];
+            grown[shape->hash % count] = shape;
+            shape = next;
+        }
+    }
+
+    free(buckets);
+    buckets = grown;
+    bucketCount = count;
+}
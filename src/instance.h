@@ -0,0 +1,30 @@
+/* PostGen Instances
+ *
+ * Recognizes paths that have been drawn before at another position, so they
+ * can be defined once as a procedure and drawn by calling it.
+ */
+
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The number of shapes drawn as instances in a session
+typedef struct InstanceStats {
+    int defined;
+    int instanced;
+} InstanceStats;
+
+// Public function prototypes:
+
+// Forgets every shape, for a new session
+void instanceReset( void );
+
+// Looks up a path by its shape, ignoring where it is drawn
+int instanceFind( const int64_t* points, int count, bool curve, bool* define );
+
+// Gets the number of shapes drawn as instances in the session
+InstanceStats instanceStats( void );
+
+#endif
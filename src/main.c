@@ -6,35 +6,134 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
 
+#include "analyze.h"
+#include "backend.h"
 #include "eval.h"
+#include "number.h"
+#include "pool.h"
 
 // Version string
 const char* version = "Development Build";
 
+/*
+ * Prints the usage message and exits with failure.
+ */
+static void usage( void ) {
+    printf( "Usage: postgen [options] [filename] (optional)\n" );
+    printf( "Options:\n" );
+    printf( "  --precision <digits>\tFractional digits written for coordinates (0-%d, default %d)\n",
+            MAX_PRECISION, DEFAULT_PRECISION );
+    printf( "  --async\t\tWrite session files in the background\n" );
+    printf( "  --output-fd <fd>\tStream every session to the given descriptor (1 for stdout)\n" );
+    printf( "  --forms\t\tWrite loop and rotate blocks as cacheable forms\n" );
+    printf( "  --cull\t\tLeave out shapes hidden under later fills\n" );
+    printf( "  --relative\t\tWrite path points relative to each other (rlineto/rcurveto)\n" );
+    printf( "  --jobs <count>\tGenerate the shapes of scripts on this many threads (1-%d)\n",
+            MAX_POOL_WORKERS );
+    printf( "  --flatten <bytes>\tEvaluate loops and rotations, expanding loops up to this size\n" );
+    printf( "  --instance\t\tDraw repeated shapes by calling a procedure defined once\n" );
+    printf( "  --watch\t\tRun the script again whenever it changes\n" );
+    printf( "  --backend <name>\tWrite sessions as ps (PostScript, the default) or svg\n" );
+    printf( "  --analyze\t\tReport the render cost of each session instead of writing it\n" );
+    exit(EXIT_FAILURE);
+}
+
 /*
  * Starts the interpreter.
  * If a script file is provided at runtime, then it will be evaluated.
  */
 int main( int argc, char* argv[] ) {
+    char* filename = NULL;
+    Options options = { .outputFd = -1, .jobs = 1, .backend = &postscriptBackend };
+
     // Handle args
-    if( argc > 2 ) {
-        printf( "Too many arguments provided!\n" );
-        printf( "Usage: postgen [filename] (optional)\n" );
-        exit(EXIT_FAILURE);
+    for( int i = 1; i < argc; i++ ) {
+        if( strcmp( argv[i], "--precision" ) == 0 ) {
+            long digits;
+            if( i + 1 >= argc || !parseInteger( argv[++i], &digits ) || !setPrecision( digits ) ) {
+                printf( "Invalid precision provided!\n" );
+                usage();
+            }
+        } else if( strcmp( argv[i], "--async" ) == 0 ) {
+            options.asyncOutput = true;
+        } else if( strcmp( argv[i], "--output-fd" ) == 0 ) {
+            long fd;
+            if( i + 1 >= argc || !parseInteger( argv[++i], &fd ) || fd < 0 || fcntl( fd, F_GETFD ) < 0 ) {
+                printf( "Invalid output descriptor provided!\n" );
+                usage();
+            }
+            options.outputFd = fd;
+        } else if( strcmp( argv[i], "--forms" ) == 0 ) {
+            options.forms = true;
+        } else if( strcmp( argv[i], "--cull" ) == 0 ) {
+            options.cull = true;
+        } else if( strcmp( argv[i], "--relative" ) == 0 ) {
+            options.relative = true;
+        } else if( strcmp( argv[i], "--jobs" ) == 0 ) {
+            long jobs;
+            if( i + 1 >= argc || !parseInteger( argv[++i], &jobs ) || jobs < 1 || jobs > MAX_POOL_WORKERS ) {
+                printf( "Invalid number of jobs provided!\n" );
+                usage();
+            }
+            options.jobs = jobs;
+        } else if( strcmp( argv[i], "--flatten" ) == 0 ) {
+            long budget;
+            if( i + 1 >= argc || !parseInteger( argv[++i], &budget ) || budget < 0 ) {
+                printf( "Invalid flatten budget provided!\n" );
+                usage();
+            }
+            options.flatten = true;
+            options.flattenBudget = budget;
+        } else if( strcmp( argv[i], "--instance" ) == 0 ) {
+            options.instance = true;
+        } else if( strcmp( argv[i], "--watch" ) == 0 ) {
+            options.watch = true;
+        } else if( strcmp( argv[i], "--backend" ) == 0 ) {
+            if( i + 1 >= argc || (options.backend = findBackend( argv[++i] )) == NULL ) {
+                printf( "Unknown backend provided!\n" );
+                usage();
+            }
+        } else if( strcmp( argv[i], "--analyze" ) == 0 ) {
+            options.analyze = true;
+        } else if( strncmp( argv[i], "--", 2 ) == 0 ) {
+            printf( "Unknown option: %s\n", argv[i] );
+            usage();
+        } else if( filename != NULL ) {
+            printf( "Too many arguments provided!\n" );
+            usage();
+        } else {
+            filename = argv[i];
+        }
     }
 
-    // Print program info
-    printf( "PostGen - PostScript Generator\n" );
-    printf( "Version: %s\n", version );
-    printf( "Enter a command, or 'help' to view available commands.\n" );
-
-    // Start the interpreter
-    if( argc == 2 ) {
-        // Evaluate the contents of the defined script file
-        run(argv[1]);
-    } else {
-        // Run the interpreter interactively
-        run(NULL);
+    // Only a script can be watched
+    if( options.watch && filename == NULL ) {
+        printf( "A script must be provided to watch!\n" );
+        usage();
     }
+
+    // Sessions are analyzed as the script draws them, on one thread, so the
+    // options that only change how they're written are ignored
+    if( options.analyze ) {
+        if( options.backend != &postscriptBackend || options.watch || options.outputFd >= 0 ) {
+            printf( "--analyze cannot be used with --backend, --watch or --output-fd!\n" );
+            usage();
+        }
+        options.backend = &analyzeBackend;
+        options.jobs = 1;
+        options.forms = options.instance = options.relative = options.cull = false;
+    }
+
+    // Forms, instances and relative points are written as PostScript
+    if( options.backend != &postscriptBackend && (options.forms || options.instance || options.relative) ) {
+        printf( "--forms, --instance and --relative can only be used with the ps backend!\n" );
+        usage();
+    }
+
+    // Start the interpreter. If filename is NULL it runs interactively,
+    // otherwise the contents of the script file are evaluated.
+    run(filename, version, &options);
 }
@@ -0,0 +1,354 @@
+/* PostGen Number
+ *
+ * Every number read from a command, and every number written to a session,
+ * goes through this file.
+ *
+ * Numbers are parsed by hand rather than with atoi/strtol/strtod so that all
+ * commands accept the same forms, reject trailing garbage, and behave the same
+ * regardless of the current locale. Likewise numbers are formatted by hand with
+ * a fixed number of fractional digits and trailing zeros trimmed, so whole
+ * numbers are written as integers.
+ *
+ * Numbers can also be quantized to the current precision, as a whole number
+ * of steps, so that the differences between them are exact.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "number.h"
+
+// The most significant digits that are accumulated exactly
+#define MAX_DIGITS 19
+
+// Powers of ten that are exactly representable as doubles
+static const double exactPowers[] =
+        {
+            1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+            1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+            1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+// Powers of ten used to scale numbers while formatting
+static const int64_t scales[MAX_PRECISION + 1] =
+        {
+            1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL,
+            10000000LL, 100000000LL, 1000000000LL
+        };
+
+// The number of fractional digits numbers are formatted with
+static int precision = DEFAULT_PRECISION;
+
+// The largest quantized magnitude, small enough that differences fit
+#define MAX_UNITS 4.6e18
+
+// Private function prototypes:
+
+static int formatFixed( char* buf, int64_t fixed, bool compact );
+
+/*
+ * Parses a number in integer (12), decimal (-1.5, .5, 2.) or exponent (1e3,
+ * 2.5E-2) form. The whole string must be a number; leading or trailing
+ * characters, hex, infinities and NaNs are all rejected.
+ *
+ * Numbers of up to 15 significant digits with small exponents, which covers
+ * any coordinate in practice, are converted exactly. Longer numbers are
+ * rounded to the nearest representable value within a few units in the last
+ * place.
+ *
+ * Input:
+ * const char* str - The string to parse.
+ * double* value   - Used to return the parsed number.
+ *
+ * Returns:
+ * True if the string is a valid, finite number, false otherwise.
+ */
+bool parseNumber( const char* str, double* value ) {
+    const char* c = str;
+
+    // Optional sign
+    bool negative = false;
+    if( *c == '+' || *c == '-' ) {
+        negative = (*c == '-');
+        c++;
+    }
+
+    // Mantissa digits, before and after the decimal point
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool seenDigit = false;
+
+    while( *c >= '0' && *c <= '9' ) {
+        seenDigit = true;
+        if( digits < MAX_DIGITS ) {
+            mantissa = mantissa * 10 + (*c - '0');
+            // Leading zeros are not significant
+            if( mantissa != 0 ) {
+                digits++;
+            }
+        } else {
+            // Digits we can't hold only scale the number
+            exponent++;
+        }
+        c++;
+    }
+
+    if( *c == '.' ) {
+        c++;
+        while( *c >= '0' && *c <= '9' ) {
+            seenDigit = true;
+            if( digits < MAX_DIGITS ) {
+                mantissa = mantissa * 10 + (*c - '0');
+                if( mantissa != 0 ) {
+                    digits++;
+                }
+                exponent--;
+            }
+            c++;
+        }
+    }
+
+    // There must be at least one digit in the mantissa
+    if(!seenDigit) {
+        return false;
+    }
+
+    // Optional exponent
+    if( *c == 'e' || *c == 'E' ) {
+        c++;
+
+        bool negativeExp = false;
+        if( *c == '+' || *c == '-' ) {
+            negativeExp = (*c == '-');
+            c++;
+        }
+
+        // The exponent must have digits
+        if( *c < '0' || *c > '9' ) {
+            return false;
+        }
+
+        int exp = 0;
+        while( *c >= '0' && *c <= '9' ) {
+            // Clamp absurd exponents, which overflow or underflow anyway
+            if( exp < 10000 ) {
+                exp = exp * 10 + (*c - '0');
+            }
+            c++;
+        }
+        exponent += negativeExp ? -exp : exp;
+    }
+
+    // The entire string must have been consumed
+    if( *c != '\0' ) {
+        return false;
+    }
+
+    double result;
+    if( mantissa == 0 ) {
+        result = 0.0;
+    } else if( mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22 ) {
+        // Both operands are exact, so a single operation rounds correctly
+        result = (double)mantissa;
+        if( exponent < 0 ) {
+            result /= exactPowers[-exponent];
+        } else {
+            result *= exactPowers[exponent];
+        }
+    } else {
+        // Scale in extended precision to limit the rounding error
+        long double scaled = (long double)mantissa;
+        int exp = exponent < 0 ? -exponent : exponent;
+        long double power = 1.0L;
+        long double base = 10.0L;
+        while( exp > 0 ) {
+            if( exp & 1 ) {
+                power *= base;
+            }
+            base *= base;
+            exp >>= 1;
+        }
+        scaled = exponent < 0 ? scaled / power : scaled * power;
+        result = (double)scaled;
+    }
+
+    // Reject numbers too large to represent
+    if( isinf(result) ) {
+        return false;
+    }
+
+    *value = negative ? -result : result;
+    return true;
+}
+
+/*
+ * Parses a number that must be whole, such as a count. Any form accepted by
+ * parseNumber is allowed, so long as it has no fractional part.
+ *
+ * Input:
+ * const char* str - The string to parse.
+ * long* value     - Used to return the parsed number.
+ *
+ * Returns:
+ * True if the string is a valid whole number, false otherwise.
+ */
+bool parseInteger( const char* str, long* value ) {
+    double number;
+    if( !parseNumber( str, &number ) || number != floor(number)
+        || number < -2147483648.0 || number > 2147483647.0 ) {
+        return false;
+    }
+
+    *value = (long)number;
+    return true;
+}
+
+/*
+ * Formats a number with the current precision. Trailing fractional zeros are
+ * removed, so whole numbers are formatted as integers.
+ *
+ * Input:
+ * char* buf    - Where to write the number. Must hold NUMBER_BUF_SIZE chars.
+ * double value - The number to format.
+ *
+ * Returns:
+ * The length of the formatted number.
+ */
+int formatNumber( char* buf, double value ) {
+    int64_t scale = scales[precision];
+    double scaled = value * (double)scale;
+
+    // Numbers too large for the fast path are rare; let stdio handle them
+    if( !(scaled > -9.2e18 && scaled < 9.2e18) ) {
+        int length = snprintf( buf, NUMBER_BUF_SIZE, "%.*f", precision, value );
+        // Trim trailing zeros and the decimal point
+        if( precision > 0 ) {
+            while( buf[length - 1] == '0' ) {
+                length--;
+            }
+            if( buf[length - 1] == '.' ) {
+                length--;
+            }
+            buf[length] = '\0';
+        }
+        return length;
+    }
+
+    // Round to the nearest representable step
+    return formatFixed( buf, (int64_t)llround(scaled), false );
+}
+
+/*
+ * Quantizes a number to the current precision.
+ *
+ * Input:
+ * double value   - The number to quantize.
+ * int64_t* units - Used to return the number as a whole number of steps of
+ *                  the current precision.
+ *
+ * Returns:
+ * True if the number was quantized, false if it is too large.
+ */
+bool quantize( double value, int64_t* units ) {
+    double scaled = value * (double)scales[precision];
+    if( !(scaled > -MAX_UNITS && scaled < MAX_UNITS) ) {
+        return false;
+    }
+
+    *units = (int64_t)llround(scaled);
+    return true;
+}
+
+/*
+ * Formats a quantized number as compactly as possible: trailing fractional
+ * zeros are removed, and so is the zero before the decimal point of numbers
+ * smaller than one, which PostScript doesn't need.
+ *
+ * Input:
+ * char* buf     - Where to write the number. Must hold NUMBER_BUF_SIZE chars.
+ * int64_t units - The number, in steps of the current precision.
+ *
+ * Returns:
+ * The length of the formatted number.
+ */
+int formatUnits( char* buf, int64_t units ) {
+    return formatFixed( buf, units, true );
+}
+
+/*
+ * Formats a fixed point number with the current precision.
+ *
+ * Input:
+ * char* buf     - Where to write the number.
+ * int64_t fixed - The number, in steps of the current precision.
+ * bool compact  - Whether to leave out the zero before the decimal point.
+ *
+ * Returns:
+ * The length of the formatted number.
+ */
+int formatFixed( char* buf, int64_t fixed, bool compact ) {
+    char digits[24];
+    int count = 0;
+    bool negative = fixed < 0;
+    uint64_t magnitude = negative ? -(uint64_t)fixed : (uint64_t)fixed;
+
+    // Write the digits in reverse, skipping trailing fractional zeros
+    int fraction = precision;
+    while( fraction > 0 && magnitude % 10 == 0 && magnitude != 0 ) {
+        magnitude /= 10;
+        fraction--;
+    }
+    if( magnitude == 0 ) {
+        fraction = 0;
+    }
+    do {
+        digits[count++] = '0' + (magnitude % 10);
+        magnitude /= 10;
+    } while( magnitude != 0 || count < fraction || (count == fraction && !compact) );
+
+    // Copy the digits out in order, inserting the decimal point
+    int length = 0;
+    if( negative && fixed != 0 ) {
+        buf[length++] = '-';
+    }
+    while( count > 0 ) {
+        if( count == fraction ) {
+            buf[length++] = '.';
+        }
+        buf[length++] = digits[--count];
+    }
+    buf[length] = '\0';
+
+    return length;
+}
+
+/*
+ * Sets the number of fractional digits numbers are formatted with.
+ *
+ * Input:
+ * int digits - The number of digits, from 0 to MAX_PRECISION.
+ *
+ * Returns:
+ * True if the precision was set, false if it is out of range.
+ */
+bool setPrecision( int digits ) {
+    if( digits < 0 || digits > MAX_PRECISION ) {
+        return false;
+    }
+
+    precision = digits;
+    return true;
+}
+
+/*
+ * Gets the number of fractional digits numbers are formatted with.
+ *
+ * Returns:
+ * The current precision.
+ */
+int getPrecision( void ) {
+    return precision;
+}
@@ -0,0 +1,46 @@
+/* PostGen Number
+ *
+ * Provides locale independent parsing and formatting of the numbers used in
+ * commands and in the generated PostScript.
+ */
+
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The default number of fractional digits numbers are formatted with
+#define DEFAULT_PRECISION 6
+
+// The largest number of fractional digits numbers may be formatted with
+#define MAX_PRECISION 9
+
+// Enough space for any number formatted by formatNumber
+#define NUMBER_BUF_SIZE 64
+
+// Public function prototypes:
+
+// Parses a number in integer, decimal or exponent form
+bool parseNumber( const char* str, double* value );
+
+// Parses a number that must be a whole number
+bool parseInteger( const char* str, long* value );
+
+// Formats a number using the current precision
+int formatNumber( char* buf, double value );
+
+// Quantizes a number to the current precision
+bool quantize( double value, int64_t* units );
+
+// Formats a quantized number compactly
+int formatUnits( char* buf, int64_t units );
+
+// Sets the number of fractional digits numbers are formatted with
+bool setPrecision( int digits );
+
+// Gets the number of fractional digits numbers are formatted with
+int getPrecision( void );
+
+#endif
@@ -0,0 +1,635 @@
+/* PostGen Parser
+ *
+ * Turns a script into a tree of commands before anything is executed, so a
+ * script with a syntax error doesn't produce half a file, and so blocks can
+ * be nested to any depth.
+ *
+ * The grammar is line based:
+ *
+ *   script    := statement*
+ *   statement := command | path | block
+ *   command   := word arg* NEWLINE
+ *   path      := path-word arg* NEWLINE (x y NEWLINE)* 'done' NEWLINE
+ *   block     := block-word arg* '{' NEWLINE statement* '}' NEWLINE
+ *              | block-word arg* NEWLINE statement* end-word NEWLINE
+ *
+ * where the end word of a block is 'endloop', 'endrotate', 'enddef' or
+ * 'endpattern'. Blank lines, and lines starting with '#', are ignored. The
+ * last argument of a text command is the rest of its line, spaces and all.
+ *
+ * Interactive input is parsed the same way, except that the user is prompted
+ * for each line, and a block that isn't opened with '{' is read with the
+ * original protocol: one command at a time, each followed by a y/n answer to
+ * whether the block is finished.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "parser.h"
+
+// The characters that separate words
+#define SEPARATORS " \t\r\n"
+
+// A command that takes a list of points
+typedef struct PathCommand {
+    const char* name;
+    // The fewest points that make a valid shape
+    int minPoints;
+} PathCommand;
+
+// A command that takes a block
+typedef struct BlockCommand {
+    const char* name;
+    // The word that ends the block when it isn't delimited with braces
+    const char* end;
+    // Used to describe the block when prompting the user
+    const char* description;
+    const char* prompt;
+} BlockCommand;
+
+// List of commands that take points
+static const PathCommand pathCommands[] =
+        {
+            { "path", 0 },
+            { "closedpath", 0 },
+            { "solidpath", 0 },
+            { "curve", 3 },
+            { "closedcurve", 3 },
+            { "solidcurve", 3 },
+            { "patternpath", 0 }
+        };
+
+// List of commands that take blocks
+static const BlockCommand blockCommands[] =
+        {
+            { "loop", "endloop", "loop", "#> " },
+            { "rotate", "endrotate", "rotate", "+> " },
+            { "define", "enddef", NULL, "&> " },
+            { "pattern", "endpattern", NULL, "%> " }
+        };
+
+// A command whose last argument is the rest of the line
+typedef struct LineCommand {
+    const char* name;
+    // The position of the last argument
+    int last;
+} LineCommand;
+
+// List of commands whose last argument is the rest of the line
+static const LineCommand lineCommands[] =
+        {
+            { "text", 5 }
+        };
+
+#define NUM_PATH_COMMANDS (sizeof(pathCommands) / sizeof(pathCommands[0]))
+#define NUM_BLOCK_COMMANDS (sizeof(blockCommands) / sizeof(blockCommands[0]))
+#define NUM_LINE_COMMANDS (sizeof(lineCommands) / sizeof(lineCommands[0]))
+
+// Private function prototypes:
+
+static int readLine( Parser* parser, const char* prompt, char*** words );
+static void freeWords( int count, char** words );
+static void error( Parser* parser, const char* message, const char* word );
+static const PathCommand* findPathCommand( const char* name );
+static const BlockCommand* findBlockCommand( const char* name );
+static int findLastArgument( const char* name );
+static Node* parseStatement( Parser* parser, int argc, char** argv );
+static bool parsePoints( Parser* parser, Node* node, const PathCommand* command );
+static Node* parseBlock( Parser* parser, const char* end, const char* prompt, bool* closed );
+static Node* parsePromptedBlock( Parser* parser, const BlockCommand* command );
+
+/*
+ * Prepares to parse a stream.
+ *
+ * Input:
+ * Parser* parser   - The parser to initialize.
+ * FILE* in         - The stream to parse.
+ * const char* name - The name of the stream, used in errors.
+ * bool interactive - Whether a user is typing the input.
+ */
+void parserInit( Parser* parser, FILE* in, const char* name, bool interactive ) {
+    parser->in = in;
+    parser->name = name;
+    parser->line = 0;
+    parser->interactive = interactive;
+    parser->failed = false;
+}
+
+/*
+ * Parses every command up to the end of the stream.
+ *
+ * Input:
+ * Parser* parser - The parser.
+ *
+ * Returns:
+ * The parsed commands, in order. If there were any errors they have been
+ * reported, parser->failed is set and NULL is returned.
+ */
+Node* parseScript( Parser* parser ) {
+    bool closed;
+    Node* nodes = parseBlock( parser, NULL, NULL, &closed );
+
+    if( parser->failed ) {
+        freeNodes(nodes);
+        return NULL;
+    }
+
+    return nodes;
+}
+
+/*
+ * Parses the next command, including its points or block.
+ *
+ * Input:
+ * Parser* parser - The parser.
+ * bool* eof      - Set if the end of the stream was reached.
+ *
+ * Returns:
+ * The command, or NULL if the end of the stream was reached or the command
+ * had errors (which have been reported).
+ */
+Node* parseNext( Parser* parser, bool* eof ) {
+    *eof = false;
+
+    char** argv;
+    int argc = readLine( parser, NULL, &argv );
+    if( argc < 0 ) {
+        *eof = true;
+        return NULL;
+    }
+    if( argc == 0 ) {
+        return NULL;
+    }
+
+    return parseStatement( parser, argc, argv );
+}
+
+/*
+ * Checks if a command takes a list of points.
+ *
+ * Input:
+ * const char* name - The name of the command.
+ *
+ * Returns:
+ * True if the command is followed by points.
+ */
+bool isPathCommand( const char* name ) {
+    return findPathCommand(name) != NULL;
+}
+
+/*
+ * Checks if a command takes a block.
+ *
+ * Input:
+ * const char* name - The name of the command.
+ *
+ * Returns:
+ * True if the command is followed by a block.
+ */
+bool isBlockCommand( const char* name ) {
+    return findBlockCommand(name) != NULL;
+}
+
+/*
+ * Frees a list of commands, and everything belonging to them.
+ *
+ * Input:
+ * Node* node - The first command in the list.
+ */
+void freeNodes( Node* node ) {
+    while( node != NULL ) {
+        Node* next = node->next;
+        freeWords( node->argc, node->argv );
+        freeWords( node->pointc, node->points );
+        freeNodes( node->body );
+        free(node);
+        node = next;
+    }
+}
+
+/*
+ * Reads the next line that isn't blank or a comment, and splits it into
+ * words.
+ *
+ * Input:
+ * Parser* parser     - The parser.
+ * const char* prompt - (optional) Printed before reading, if interactive.
+ * char*** words      - Used to return the words. Must be freed with freeWords.
+ *
+ * Returns:
+ * The number of words, or -1 at the end of the stream. Interactive input
+ * returns 0 for blank lines, so the user is prompted again.
+ */
+int readLine( Parser* parser, const char* prompt, char*** words ) {
+    char* line = NULL;
+    size_t size = 0;
+
+    while(1) {
+        if( parser->interactive && prompt != NULL ) {
+            printf( "%s", prompt );
+            fflush(stdout);
+        }
+
+        if( getline( &line, &size, parser->in ) < 0 ) {
+            free(line);
+            return -1;
+        }
+        parser->line++;
+
+        // Count the words so the list can be allocated at once
+        int count = 0;
+        char* copy = strdup(line);
+        for( char* word = strtok( copy, SEPARATORS ); word != NULL; word = strtok( NULL, SEPARATORS ) ) {
+            count++;
+        }
+        free(copy);
+
+        // Skip blank lines and comments
+        char* first = line + strspn( line, SEPARATORS );
+        if( count == 0 || *first == '#' ) {
+            if( parser->interactive ) {
+                free(line);
+                *words = NULL;
+                return 0;
+            }
+            continue;
+        }
+
+        *words = (char**)malloc(count * sizeof(char*));
+        char* raw = strdup(line);
+        int last = -1;
+        int i = 0;
+        for( char* word = strtok( line, SEPARATORS ); word != NULL; word = strtok( NULL, SEPARATORS ) ) {
+            if( i == 0 ) {
+                last = findLastArgument(word);
+            }
+            if( i == last ) {
+                // Take the rest of the line instead, without its line ending
+                char* rest = raw + (word - line);
+                rest[strcspn( rest, "\r\n" )] = '\0';
+                (*words)[i++] = strdup(rest);
+                break;
+            }
+            (*words)[i++] = strdup(word);
+        }
+        free(raw);
+        free(line);
+        count = i;
+
+        return count;
+    }
+}
+
+/*
+ * Frees a list of words.
+ *
+ * Input:
+ * int count    - The number of words.
+ * char** words - The words.
+ */
+void freeWords( int count, char** words ) {
+    for( int i = 0; i < count; i++ ) {
+        free( words[i] );
+    }
+    free(words);
+}
+
+/*
+ * Reports a syntax error. Errors in scripts fail the whole parse, while
+ * interactive errors only discard the current command.
+ *
+ * Input:
+ * Parser* parser      - The parser.
+ * const char* message - Describes the error.
+ * const char* word    - (optional) The word the error is about.
+ */
+void error( Parser* parser, const char* message, const char* word ) {
+    if( parser->interactive ) {
+        printf( "\nERROR:\t%s", message );
+    } else {
+        printf( "\nERROR:\t%s:%d: %s", parser->name, parser->line, message );
+    }
+    if( word != NULL ) {
+        printf( " '%s'", word );
+    }
+    printf( "\n" );
+
+    parser->failed = true;
+}
+
+/*
+ * Looks up a command that takes a list of points.
+ *
+ * Input:
+ * const char* name - The name of the command.
+ *
+ * Returns:
+ * The command, or NULL if it doesn't take points.
+ */
+const PathCommand* findPathCommand( const char* name ) {
+    for( size_t i = 0; i < NUM_PATH_COMMANDS; i++ ) {
+        if( strcmp( pathCommands[i].name, name ) == 0 ) {
+            return &pathCommands[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Looks up a command that takes a block.
+ *
+ * Input:
+ * const char* name - The name of the command.
+ *
+ * Returns:
+ * The command, or NULL if it doesn't take a block.
+ */
+const BlockCommand* findBlockCommand( const char* name ) {
+    for( size_t i = 0; i < NUM_BLOCK_COMMANDS; i++ ) {
+        if( strcmp( blockCommands[i].name, name ) == 0 ) {
+            return &blockCommands[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Looks up the position of the argument that takes the rest of the line.
+ *
+ * Input:
+ * const char* name - The name of the command.
+ *
+ * Returns:
+ * The position of the argument, or -1 if the command's arguments are all
+ * single words.
+ */
+int findLastArgument( const char* name ) {
+    for( size_t i = 0; i < NUM_LINE_COMMANDS; i++ ) {
+        if( strcmp( lineCommands[i].name, name ) == 0 ) {
+            return lineCommands[i].last;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Parses a statement, given the words of its first line.
+ *
+ * Input:
+ * Parser* parser     - The parser.
+ * int argc           - The number of words on the first line.
+ * char** argv        - The words on the first line. Owned by the result.
+ *
+ * Returns:
+ * The statement, or NULL on error.
+ */
+Node* parseStatement( Parser* parser, int argc, char** argv ) {
+    Node* node = (Node*)calloc( 1, sizeof(Node) );
+    node->line = parser->line;
+    node->argc = argc;
+    node->argv = argv;
+
+    // Commands that take points read them up to 'done'
+    const PathCommand* path = findPathCommand( argv[0] );
+    if( path != NULL ) {
+        if( !parsePoints( parser, node, path ) ) {
+            freeNodes(node);
+            return NULL;
+        }
+        return node;
+    }
+
+    // Commands that take blocks read them up to their end
+    const BlockCommand* block = findBlockCommand( argv[0] );
+    if( block == NULL ) {
+        return node;
+    }
+
+    int startLine = parser->line;
+    bool closed = false;
+    if( strcmp( argv[argc - 1], "{" ) == 0 ) {
+        // The brace isn't an argument
+        free( argv[argc - 1] );
+        node->argc--;
+
+        if( parser->interactive ) {
+            printf( "\nEnter commands, and '}' when finished:\n" );
+        }
+        node->body = parseBlock( parser, "}", block->prompt, &closed );
+    } else if( parser->interactive && block->description != NULL ) {
+        node->body = parsePromptedBlock( parser, block );
+        closed = true;
+    } else {
+        if( parser->interactive ) {
+            printf( "\nEnter commands, and '%s' when finished:\n", block->end );
+        }
+        node->body = parseBlock( parser, block->end, block->prompt, &closed );
+    }
+
+    if(!closed) {
+        char message[64];
+        snprintf( message, sizeof(message), "Block started on line %d is never closed by", startLine );
+        error( parser, message, node->argc < argc ? "}" : block->end );
+    }
+    if( parser->failed ) {
+        freeNodes(node);
+        return NULL;
+    }
+
+    return node;
+}
+
+/*
+ * Parses the points following a path command, up to 'done'.
+ *
+ * Input:
+ * Parser* parser             - The parser.
+ * Node* node                 - The path command.
+ * const PathCommand* command - Describes the path command.
+ *
+ * Returns:
+ * True if the points were parsed successfully.
+ */
+bool parsePoints( Parser* parser, Node* node, const PathCommand* command ) {
+    if( parser->interactive ) {
+        printf( "\nEnter a series of points (one tuple per line), and 'done' when finished:\n" );
+    }
+
+    int capacity = 0;
+    while(1) {
+        char** words;
+        int count = readLine( parser, ": ", &words );
+        if( count < 0 ) {
+            error( parser, "Points never finished with", "done" );
+            return false;
+        }
+        if( count == 0 ) {
+            continue;
+        }
+
+        if( count == 1 && strcmp( words[0], "done" ) == 0 ) {
+            freeWords( count, words );
+
+            // Make sure there are enough points for the shape
+            int points = node->pointc / 2;
+            if( points >= command->minPoints ) {
+                return true;
+            }
+
+            if( parser->interactive ) {
+                // Let the user add the missing points
+                printf( "ERROR:\t Need at least %d more points to create a valid curve!\n",
+                        command->minPoints - points );
+                continue;
+            }
+            error( parser, "Not enough points for", node->argv[0] );
+            return false;
+        }
+
+        if( count != 2 ) {
+            freeWords( count, words );
+            if( parser->interactive ) {
+                // Let the user try again
+                printf( "ERROR:\tInvalid number of arguments provided!\n" );
+                printf( "Usage:\t<x> <y>\n");
+                continue;
+            }
+            error( parser, "Expected a point '<x> <y>' or", "done" );
+            return false;
+        }
+
+        // Add the point to the node
+        if( node->pointc + 2 > capacity ) {
+            capacity = capacity ? capacity * 2 : 16;
+            node->points = (char**)realloc( node->points, capacity * sizeof(char*) );
+        }
+        node->points[node->pointc++] = words[0];
+        node->points[node->pointc++] = words[1];
+        free(words);
+    }
+}
+
+/*
+ * Parses statements up to the word that ends a block.
+ *
+ * Input:
+ * Parser* parser     - The parser.
+ * const char* end    - (optional) The word that ends the block. If NULL, the
+ *                      block ends at the end of the stream.
+ * const char* prompt - (optional) Printed before each line, if interactive.
+ * bool* closed       - Set if the end word was found.
+ *
+ * Returns:
+ * The statements in the block, which may be incomplete if there were errors.
+ */
+Node* parseBlock( Parser* parser, const char* end, const char* prompt, bool* closed ) {
+    Node* first = NULL;
+    Node* last = NULL;
+    *closed = false;
+
+    while(1) {
+        char** words;
+        int count = readLine( parser, prompt, &words );
+        if( count < 0 ) {
+            return first;
+        }
+        if( count == 0 ) {
+            continue;
+        }
+
+        // Check for the end of the block
+        if( end != NULL && strcmp( words[0], end ) == 0 ) {
+            if( count != 1 ) {
+                error( parser, "Unexpected words after", end );
+            }
+            freeWords( count, words );
+            *closed = true;
+            return first;
+        }
+
+        // A stray closing brace or end word is an error
+        if( strcmp( words[0], "}" ) == 0 || strcmp( words[0], "endloop" ) == 0
+            || strcmp( words[0], "endrotate" ) == 0 || strcmp( words[0], "enddef" ) == 0
+            || strcmp( words[0], "endpattern" ) == 0 ) {
+            error( parser, "Unexpected", words[0] );
+            freeWords( count, words );
+            continue;
+        }
+
+        Node* node = parseStatement( parser, count, words );
+        if( node == NULL ) {
+            // Interactive input carries on with the rest of the block
+            if( parser->interactive ) {
+                parser->failed = false;
+                continue;
+            }
+            return first;
+        }
+
+        if( last == NULL ) {
+            first = node;
+        } else {
+            last->next = node;
+        }
+        last = node;
+    }
+}
+
+/*
+ * Parses a block using the interactive prompt protocol: the user enters one
+ * command at a time, and after each one is asked if the block is finished.
+ *
+ * Input:
+ * Parser* parser              - The parser.
+ * const BlockCommand* command - Describes the block command.
+ *
+ * Returns:
+ * The statements in the block.
+ */
+Node* parsePromptedBlock( Parser* parser, const BlockCommand* command ) {
+    Node* first = NULL;
+    Node* last = NULL;
+
+    while(1) {
+        printf( "\nEnter commands to construct a block of code to %s:\n", command->description );
+        // Print block prompt
+        printf( "%s", command->prompt );
+        fflush(stdout);
+
+        // Parse the next command of the block
+        bool eof;
+        Node* node = parseNext( parser, &eof );
+        if(eof) {
+            return first;
+        }
+        parser->failed = false;
+
+        if( node != NULL ) {
+            if( last == NULL ) {
+                first = node;
+            } else {
+                last->next = node;
+            }
+            last = node;
+        }
+
+        // Ask the user if they wish to enter more commands
+        printf( "\nFinished constructing %s block? (y/n) ", command->description );
+        fflush(stdout);
+        char* ans = NULL;
+        size_t size = 0;
+        // Check input and verify its validity
+        bool finished = getline( &ans, &size, parser->in ) < 0 || strcmp( ans, "y\n" ) == 0;
+        parser->line++;
+        free(ans);
+        if(finished) {
+            return first;
+        }
+    }
+}
@@ -0,0 +1,62 @@
+/* PostGen Parser
+ *
+ * Provides parsing of scripts and interactive input into a tree of commands.
+ */
+
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// A parsed command, along with the points or block that belong to it
+typedef struct Node {
+    // The line the command started on
+    int line;
+    // The command and its arguments
+    int argc;
+    char** argv;
+    // The coordinates of the points given to a path command, two per point
+    int pointc;
+    char** points;
+    // The commands in the block of a block command
+    struct Node* body;
+    // The next command at the same level
+    struct Node* next;
+} Node;
+
+// The state of a parse
+typedef struct Parser {
+    // The stream being parsed
+    FILE* in;
+    // The name of the stream, used in errors
+    const char* name;
+    // The number of the last line read
+    int line;
+    // Whether the user is typing the input, and should be prompted
+    bool interactive;
+    // Whether any errors were found
+    bool failed;
+} Parser;
+
+// Public function prototypes:
+
+// Prepares to parse a stream
+void parserInit( Parser* parser, FILE* in, const char* name, bool interactive );
+
+// Parses every command up to the end of the stream
+Node* parseScript( Parser* parser );
+
+// Parses the next command, including its points or block
+Node* parseNext( Parser* parser, bool* eof );
+
+// Checks if a command takes a list of points
+bool isPathCommand( const char* name );
+
+// Checks if a command takes a block
+bool isBlockCommand( const char* name );
+
+// Frees a list of commands, and everything belonging to them
+void freeNodes( Node* node );
+
+#endif
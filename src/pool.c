@@ -0,0 +1,292 @@
+/* PostGen Pool
+ *
+ * Jobs and already generated output are kept in a ring of slots, in the order
+ * they were submitted. Workers take jobs from the ring in order, each
+ * generating its chunk into a memory writer of its own. The thread that
+ * submits jobs also merges their output: whenever it submits something, it
+ * writes every finished chunk at the head of the ring, stopping at the first
+ * one that isn't finished, so chunks are always written in order.
+ *
+ * The ring holds a limited number of chunks, so if the workers fall behind,
+ * submitting waits for the oldest chunk instead of buffering without bound.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+// The most chunks that may be waiting to be written
+#define POOL_SLOTS 1024
+
+// A worker thread, and the writer it generates chunks into
+typedef struct Worker {
+    struct Pool* pool;
+    Writer* out;
+    pthread_t thread;
+} Worker;
+
+// A job or chunk of output in the ring
+typedef struct Slot {
+    PoolJob job;
+    void* arg;
+    char* data;
+    size_t length;
+    bool done;
+} Slot;
+
+struct Pool {
+    // Where chunks are written
+    Writer* out;
+
+    int workers;
+    Worker worker[MAX_POOL_WORKERS];
+
+    // Guards everything below
+    pthread_mutex_t lock;
+    // Signalled when there are jobs to take, or the workers should stop
+    pthread_cond_t work;
+    // Signalled when a job is done
+    pthread_cond_t done;
+
+    Slot slots[POOL_SLOTS];
+    // The next slot to write, to give to a worker, and to fill
+    unsigned long head;
+    unsigned long next;
+    unsigned long tail;
+    bool stop;
+};
+
+// Private function prototypes:
+
+static void* poolWorker( void* arg );
+static void add( Pool* pool, PoolJob job, void* arg, char* data, size_t length );
+static void merge( Pool* pool, unsigned long until );
+
+/*
+ * Starts a pool of worker threads.
+ *
+ * Input:
+ * int workers - The number of worker threads, up to MAX_POOL_WORKERS.
+ * Writer* out - Where to write the output of jobs.
+ *
+ * Returns:
+ * The pool, or NULL if it couldn't be started.
+ */
+Pool* poolOpen( int workers, Writer* out ) {
+    Pool* pool = (Pool*)calloc( 1, sizeof(Pool) );
+    if( pool == NULL ) {
+        return NULL;
+    }
+
+    pool->out = out;
+    pthread_mutex_init( &pool->lock, NULL );
+    pthread_cond_init( &pool->work, NULL );
+    pthread_cond_init( &pool->done, NULL );
+
+    if( workers > MAX_POOL_WORKERS ) {
+        workers = MAX_POOL_WORKERS;
+    }
+    for( int i = 0; i < workers; i++ ) {
+        Worker* worker = &pool->worker[i];
+        worker->pool = pool;
+        worker->out = writerOpenMemory();
+        if( worker->out == NULL ) {
+            break;
+        }
+        if( pthread_create( &worker->thread, NULL, poolWorker, worker ) != 0 ) {
+            writerClose( worker->out );
+            break;
+        }
+        pool->workers++;
+    }
+
+    // Without any workers, there's no pool
+    if( pool->workers == 0 ) {
+        poolClose(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+/*
+ * Submits a job. Its output is written after the output of everything that
+ * was submitted before it.
+ *
+ * Input:
+ * Pool* pool  - The pool.
+ * PoolJob job - The job to run on a worker.
+ * void* arg   - The argument to give the job.
+ */
+void poolSubmit( Pool* pool, PoolJob job, void* arg ) {
+    add( pool, job, arg, NULL, 0 );
+}
+
+/*
+ * Takes output that is already generated, and writes it once everything
+ * submitted before it has been written.
+ *
+ * Input:
+ * Pool* pool   - The pool.
+ * Writer* from - The memory writer the output was written to.
+ */
+void poolWrite( Pool* pool, Writer* from ) {
+    size_t length;
+    char* data = writerTake( from, &length );
+    if( data == NULL || length == 0 ) {
+        free(data);
+        return;
+    }
+
+    add( pool, NULL, NULL, data, length );
+}
+
+/*
+ * Waits for all jobs to finish, writes their output, and stops the workers.
+ *
+ * Input:
+ * Pool* pool - The pool. It is freed.
+ */
+void poolClose( Pool* pool ) {
+    pthread_mutex_lock( &pool->lock );
+    unsigned long tail = pool->tail;
+    pthread_mutex_unlock( &pool->lock );
+    merge( pool, tail );
+
+    pthread_mutex_lock( &pool->lock );
+    pool->stop = true;
+    pthread_cond_broadcast( &pool->work );
+    pthread_mutex_unlock( &pool->lock );
+    for( int i = 0; i < pool->workers; i++ ) {
+        pthread_join( pool->worker[i].thread, NULL );
+        writerClose( pool->worker[i].out );
+    }
+
+    pthread_mutex_destroy( &pool->lock );
+    pthread_cond_destroy( &pool->work );
+    pthread_cond_destroy( &pool->done );
+    free(pool);
+}
+
+/*
+ * The main loop of a worker thread. Takes jobs in order, and runs them.
+ *
+ * Input:
+ * void* arg - The worker.
+ */
+void* poolWorker( void* arg ) {
+    Pool* pool = ((Worker*)arg)->pool;
+    Writer* out = ((Worker*)arg)->out;
+
+    pthread_mutex_lock( &pool->lock );
+    while(1) {
+        // Wait for a job
+        while( pool->next == pool->tail && !pool->stop ) {
+            pthread_cond_wait( &pool->work, &pool->lock );
+        }
+        if( pool->next == pool->tail ) {
+            break;
+        }
+        Slot* slot = &pool->slots[pool->next % POOL_SLOTS];
+        pool->next++;
+
+        // Output that was already generated needs nothing done
+        if( slot->job == NULL ) {
+            continue;
+        }
+        pthread_mutex_unlock( &pool->lock );
+
+        size_t length;
+        slot->job( slot->arg, out );
+        char* data = writerTake( out, &length );
+
+        pthread_mutex_lock( &pool->lock );
+        slot->data = data;
+        slot->length = length;
+        slot->done = true;
+        pthread_cond_broadcast( &pool->done );
+    }
+    pthread_mutex_unlock( &pool->lock );
+
+    return NULL;
+}
+
+/*
+ * Adds a job or chunk of output to the end of the ring, waiting for room if
+ * it's full, then writes whatever is ready.
+ *
+ * Input:
+ * Pool* pool    - The pool.
+ * PoolJob job   - The job to run, or NULL for output that is already generated.
+ * void* arg     - The argument to give the job.
+ * char* data    - The output, if there's no job. The pool takes ownership.
+ * size_t length - The length of the output.
+ */
+void add( Pool* pool, PoolJob job, void* arg, char* data, size_t length ) {
+    // Wait for the oldest chunk if the ring is full
+    pthread_mutex_lock( &pool->lock );
+    unsigned long head = pool->head;
+    bool full = pool->tail - head == POOL_SLOTS;
+    pthread_mutex_unlock( &pool->lock );
+    if(full) {
+        merge( pool, head + 1 );
+    }
+
+    pthread_mutex_lock( &pool->lock );
+    Slot* slot = &pool->slots[pool->tail % POOL_SLOTS];
+    slot->job = job;
+    slot->arg = arg;
+    slot->data = data;
+    slot->length = length;
+    slot->done = job == NULL;
+    pool->tail++;
+    if( job != NULL ) {
+        pthread_cond_signal( &pool->work );
+    }
+    pthread_mutex_unlock( &pool->lock );
+
+    merge( pool, 0 );
+}
+
+/*
+ * Writes the finished chunks at the head of the ring, in order.
+ *
+ * Input:
+ * Pool* pool          - The pool.
+ * unsigned long until - Waits for chunks to finish until this many have been
+ *                       written, rather than stopping at the first one that
+ *                       hasn't finished.
+ */
+void merge( Pool* pool, unsigned long until ) {
+    pthread_mutex_lock( &pool->lock );
+    while( pool->head != pool->tail ) {
+        Slot* slot = &pool->slots[pool->head % POOL_SLOTS];
+        if( !slot->done ) {
+            if( pool->head >= until ) {
+                break;
+            }
+            pthread_cond_wait( &pool->done, &pool->lock );
+            continue;
+        }
+
+        // Write outside of the lock, so workers can carry on
+        pthread_mutex_unlock( &pool->lock );
+        if( slot->data != NULL ) {
+            writerWrite( pool->out, slot->data, slot->length );
+            free( slot->data );
+        }
+        pthread_mutex_lock( &pool->lock );
+        slot->data = NULL;
+        pool->head++;
+
+        // Workers needn't look at output that has already been written, and
+        // mustn't once its slot is reused
+        if( pool->next < pool->head ) {
+            pool->next = pool->head;
+        }
+    }
+    pthread_mutex_unlock( &pool->lock );
+}
@@ -0,0 +1,36 @@
+/* PostGen Pool
+ *
+ * Provides a pool of worker threads that generate chunks of output, which are
+ * written out in the order they were submitted.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include "writer.h"
+
+// The most worker threads a pool may have
+#define MAX_POOL_WORKERS 64
+
+// A job that generates a chunk of output. It is given the writer to write the
+// chunk to, and is responsible for its argument.
+typedef void (*PoolJob)( void* arg, Writer* out );
+
+// A pool of worker threads
+typedef struct Pool Pool;
+
+// Public function prototypes:
+
+// Starts a pool of workers, writing their output to the given writer
+Pool* poolOpen( int workers, Writer* out );
+
+// Submits a job, whose output is written after everything submitted before it
+void poolSubmit( Pool* pool, PoolJob job, void* arg );
+
+// Takes output that is already generated, and writes it in order
+void poolWrite( Pool* pool, Writer* from );
+
+// Waits for all jobs, writes their output, and stops the workers
+void poolClose( Pool* pool );
+
+#endif
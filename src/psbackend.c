@@ -0,0 +1,199 @@
+/* PostGen PostScript Backend
+ *
+ * Writes sessions as PostScript. This is the default format, and the only one
+ * with procedures, patterns, images and text, so the commands that write those
+ * write their PostScript themselves.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "backend.h"
+#include "gstate.h"
+#include "number.h"
+
+// Private function prototypes:
+
+static void begin( Writer* out );
+static void end( Writer* out );
+static void save( Writer* out );
+static void restore( Writer* out );
+static void rotate( Writer* out, Arg degrees );
+static void newPath( Writer* out );
+static void moveTo( Writer* out, Arg x, Arg y );
+static void lineTo( Writer* out, Arg x, Arg y );
+static void curveTo( Writer* out, const Arg points[6] );
+static void arc( Writer* out, Arg x, Arg y, Arg r );
+static void closePath( Writer* out );
+static void sync( Writer* out, unsigned parts );
+static void paint( Writer* out, bool solid );
+static void repeat( Writer* out, Arg count );
+static void endRepeat( Writer* out );
+static void writeArg( Writer* out, Arg arg );
+
+const Backend postscriptBackend =
+        {
+            .name = "ps",
+            .extension = ".ps",
+            .features = BACKEND_PROCEDURES | BACKEND_PATTERNS | BACKEND_IMAGES | BACKEND_TEXT,
+            .begin = begin,
+            .end = end,
+            .save = save,
+            .restore = restore,
+            .rotate = rotate,
+            .newPath = newPath,
+            .moveTo = moveTo,
+            .lineTo = lineTo,
+            .curveTo = curveTo,
+            .arc = arc,
+            .closePath = closePath,
+            .sync = sync,
+            .paint = paint,
+            .repeat = repeat,
+            .endRepeat = endRepeat
+        };
+
+/*
+ * Starts the page with the PostScript header.
+ */
+void begin( Writer* out ) {
+    writerPrintf( out, "%%!PS\n" );
+}
+
+/*
+ * Finishes the page.
+ */
+void end( Writer* out ) {
+    writerPrintf( out, "showpage\n" );
+}
+
+/*
+ * Saves the graphics state.
+ */
+void save( Writer* out ) {
+    writerPrintf( out, "gsave\n" );
+}
+
+/*
+ * Brings back the graphics state saved last.
+ */
+void restore( Writer* out ) {
+    writerPrintf( out, "grestore\n" );
+}
+
+/*
+ * Rotates the coordinate system.
+ */
+void rotate( Writer* out, Arg degrees ) {
+    writeArg( out, degrees );
+    writerPrintf( out, " rotate\n" );
+}
+
+/*
+ * Starts a new path.
+ */
+void newPath( Writer* out ) {
+    writerPrintf( out, "newpath\n" );
+}
+
+/*
+ * Starts a subpath at a point.
+ */
+void moveTo( Writer* out, Arg x, Arg y ) {
+    writeArg( out, x );
+    writerPrintf( out, " " );
+    writeArg( out, y );
+    writerPrintf( out, " moveto\n" );
+}
+
+/*
+ * Adds a line to a point.
+ */
+void lineTo( Writer* out, Arg x, Arg y ) {
+    writeArg( out, x );
+    writerPrintf( out, " " );
+    writeArg( out, y );
+    writerPrintf( out, " lineto\n" );
+}
+
+/*
+ * Adds a cubic curve, with each of its points on its own line.
+ */
+void curveTo( Writer* out, const Arg points[6] ) {
+    for( int i = 0; i < 6; i += 2 ) {
+        writeArg( out, points[i] );
+        writerPrintf( out, " " );
+        writeArg( out, points[i + 1] );
+        writerPrintf( out, "\n" );
+    }
+    writerPrintf( out, "curveto\n" );
+}
+
+/*
+ * Adds a full circle.
+ */
+void arc( Writer* out, Arg x, Arg y, Arg r ) {
+    writeArg( out, x );
+    writerPrintf( out, " " );
+    writeArg( out, y );
+    writerPrintf( out, " " );
+    writeArg( out, r );
+    writerPrintf( out, " 0 360 arc\n" );
+}
+
+/*
+ * Closes the current subpath.
+ */
+void closePath( Writer* out ) {
+    writerPrintf( out, "closepath\n" );
+}
+
+/*
+ * Writes the parts of the style that have changed, see gstate.c.
+ */
+void sync( Writer* out, unsigned parts ) {
+    gstateSync( out, parts );
+}
+
+/*
+ * Fills or strokes the current path. Line width and dash don't affect fills,
+ * so only the color is written for them.
+ */
+void paint( Writer* out, bool solid ) {
+    if(solid) {
+        gstateSync( out, GS_COLOR );
+        writerPrintf( out, "fill\n" );
+    } else {
+        gstateSync( out, GS_ALL );
+        writerPrintf( out, "stroke\n" );
+    }
+}
+
+/*
+ * Starts a procedure that is repeated count times.
+ */
+void repeat( Writer* out, Arg count ) {
+    writeArg( out, count );
+    writerPrintf( out, " {\n" );
+}
+
+/*
+ * Ends the procedure started by repeat.
+ */
+void endRepeat( Writer* out ) {
+    writerPrintf( out, "} repeat\n" );
+}
+
+/*
+ * Writes a numeric argument with the current precision, or the name bound to
+ * the macro parameter it refers to.
+ */
+void writeArg( Writer* out, Arg arg ) {
+    if( arg.param != NULL ) {
+        writerPrintf( out, "p_%s", arg.param );
+    } else {
+        char buf[NUMBER_BUF_SIZE];
+        int length = formatNumber( buf, arg.value );
+        writerWrite( out, buf, length );
+    }
+}
@@ -0,0 +1,691 @@
+/* PostGen SVG
+ *
+ * The file is read through a fixed buffer, one character at a time, and
+ * nothing is kept of an element once its tag has been read, so the memory
+ * used doesn't depend on the size of the file. Path data and polygon points
+ * are parsed as they are read, and each segment is passed on as soon as its
+ * last number ends, so even a path with millions of points is never held in
+ * memory.
+ *
+ * Only the geometry of <path>, <circle> and <polygon> elements is imported.
+ * A shape is filled unless its fill is 'none', in which case it is stroked.
+ * Other presentation attributes, transforms and inherited styles are
+ * ignored, so shapes are drawn in the style of the script. Arcs and
+ * quadratic curves are converted to cubic curves.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "svg.h"
+
+// The size of the buffer the file is read through
+#define SVG_BUFFER 16384
+
+// The longest element or attribute name that is recognized
+#define SVG_NAME 16
+
+// The longest attribute value kept, for attributes that aren't streamed.
+// Longer values are cut short.
+#define SVG_VALUE 256
+
+// The longest number in path data
+#define SVG_NUMBER 64
+
+// The height drawings are flipped within when their outermost <svg> element
+// gives neither a viewBox nor a height in user units: a US Letter page
+#define SVG_PAGE_HEIGHT 792
+
+// The elements that are imported
+typedef enum Element {
+    OTHER,
+    ROOT,
+    PATH,
+    CIRCLE,
+    POLYGON
+} Element;
+
+// The state of path data, or of polygon points, being parsed
+typedef struct PathData {
+    // The current command, or 0 before the first, and the one before it
+    char command;
+    char previous;
+    // The numbers given to the command so far
+    double args[7];
+    int argc;
+    // The number being read
+    char number[SVG_NUMBER];
+    int length;
+    bool point;
+    bool exponent;
+    // The current point, the start of the subpath, and the last control
+    // point of a curve, which S and T reflect
+    double x, y;
+    double startX, startY;
+    double controlX, controlY;
+    bool started;
+} PathData;
+
+// The state of an import
+typedef struct Svg {
+    FILE* in;
+    char buffer[SVG_BUFFER];
+    size_t length;
+    size_t position;
+    int line;
+    const SvgSink* sink;
+    // The height of the drawing, from which y is subtracted to flip it, and
+    // whether it has been read from the outermost <svg> element
+    double flip;
+    bool rooted;
+    const char* error;
+} Svg;
+
+// Private function prototypes:
+
+static int next( Svg* svg );
+static int skipSpace( Svg* svg );
+static void skipPast( Svg* svg, const char* end );
+static void readElement( Svg* svg, int c );
+static void readValue( Svg* svg, int quote, char* value );
+static void readData( Svg* svg, int quote, PathData* data, bool polygon );
+static void addNumber( Svg* svg, PathData* data, bool polygon );
+static void runCommand( Svg* svg, PathData* data );
+static void addArc( Svg* svg, PathData* data, double rx, double ry, double angle, bool large, bool sweep,
+                    double x, double y );
+static void moveTo( Svg* svg, PathData* data, double x, double y );
+static void lineTo( Svg* svg, PathData* data, double x, double y );
+static void curveTo( Svg* svg, PathData* data, double x1, double y1, double x2, double y2, double x, double y );
+static int arity( char command );
+
+/*
+ * Reads the shapes of an SVG file, passing each to the sink as it is read.
+ *
+ * Input:
+ * const char* filename - The SVG file.
+ * const SvgSink* sink  - Receives the shapes.
+ * int* line            - Set to the line an error was found on.
+ *
+ * Returns:
+ * NULL if the file was read, or a description of the error. Shapes before
+ * the error have already been passed to the sink.
+ */
+const char* svgImport( const char* filename, const SvgSink* sink, int* line ) {
+    *line = 0;
+    Svg* svg = (Svg*)malloc(sizeof(Svg));
+    if( svg == NULL ) {
+        return "Failed to allocate import";
+    }
+    svg->in = fopen( filename, "r" );
+    if( svg->in == NULL ) {
+        free(svg);
+        return "Failed to open SVG file";
+    }
+    svg->length = 0;
+    svg->position = 0;
+    svg->line = 1;
+    svg->sink = sink;
+    svg->flip = SVG_PAGE_HEIGHT;
+    svg->rooted = false;
+    svg->error = NULL;
+
+    int c;
+    while( svg->error == NULL && (c = next( svg )) != EOF ) {
+        if( c != '<' ) {
+            continue;
+        }
+
+        c = next( svg );
+        if( c == '!' ) {
+            // Comments, CDATA and declarations
+            int first = next( svg );
+            if( first == '-' ) {
+                skipPast( svg, "-->" );
+            } else if( first == '[' ) {
+                skipPast( svg, "]]>" );
+            } else {
+                skipPast( svg, ">" );
+            }
+        } else if( c == '?' ) {
+            skipPast( svg, "?>" );
+        } else if( c == '/' ) {
+            skipPast( svg, ">" );
+        } else if( c != EOF ) {
+            readElement( svg, c );
+        }
+    }
+
+    const char* error = svg->error;
+    *line = svg->line;
+    fclose( svg->in );
+    free(svg);
+
+    return error;
+}
+
+/*
+ * Reads the next character of the file.
+ *
+ * Returns:
+ * The character, or EOF at the end of the file.
+ */
+int next( Svg* svg ) {
+    if( svg->position == svg->length ) {
+        svg->length = fread( svg->buffer, 1, SVG_BUFFER, svg->in );
+        svg->position = 0;
+        if( svg->length == 0 ) {
+            return EOF;
+        }
+    }
+
+    int c = (unsigned char)svg->buffer[svg->position++];
+    if( c == '\n' ) {
+        svg->line++;
+    }
+    return c;
+}
+
+/*
+ * Skips whitespace.
+ *
+ * Returns:
+ * The first character after it.
+ */
+int skipSpace( Svg* svg ) {
+    int c;
+    do {
+        c = next( svg );
+    } while( c == ' ' || c == '\t' || c == '\r' || c == '\n' );
+    return c;
+}
+
+/*
+ * Skips everything up to and including the given end.
+ */
+void skipPast( Svg* svg, const char* end ) {
+    // The last characters read, compared with the end
+    size_t length = strlen( end );
+    char last[4] = { 0 };
+    int c;
+    while( (c = next( svg )) != EOF ) {
+        memmove( last, last + 1, length - 1 );
+        last[length - 1] = c;
+        if( memcmp( last, end, length ) == 0 ) {
+            return;
+        }
+    }
+}
+
+/*
+ * Reads the tag of an element, importing its shape if it has one.
+ *
+ * Input:
+ * int c - The first character of the name of the element.
+ */
+void readElement( Svg* svg, int c ) {
+    char name[SVG_NAME + 1];
+    int length = 0;
+    while( c != EOF && c != ' ' && c != '\t' && c != '\r' && c != '\n' && c != '/' && c != '>' ) {
+        if( length < SVG_NAME ) {
+            name[length++] = c;
+        }
+        c = next( svg );
+    }
+    name[length] = '\0';
+
+    Element element = strcmp( name, "svg" ) == 0 && !svg->rooted ? ROOT
+                      : strcmp( name, "path" ) == 0 ? PATH
+                      : strcmp( name, "circle" ) == 0 ? CIRCLE
+                      : strcmp( name, "polygon" ) == 0 ? POLYGON : OTHER;
+
+    PathData data = { 0 };
+    bool filled = true;
+    double circle[3] = { 0, 0, 0 };
+    double viewBox[4];
+    bool hasViewBox = false;
+
+    // Read the attributes, up to the end of the tag
+    while( svg->error == NULL ) {
+        if( c == ' ' || c == '\t' || c == '\r' || c == '\n' ) {
+            c = skipSpace( svg );
+        }
+        if( c == EOF ) {
+            svg->error = "Unexpected end of file";
+            return;
+        } else if( c == '>' ) {
+            break;
+        } else if( c == '/' ) {
+            c = next( svg );
+            continue;
+        }
+
+        char attribute[SVG_NAME + 1];
+        length = 0;
+        while( c != EOF && c != '=' && c != ' ' && c != '\t' && c != '\r' && c != '\n' && c != '>' ) {
+            if( length < SVG_NAME ) {
+                attribute[length++] = c;
+            }
+            c = next( svg );
+        }
+        attribute[length] = '\0';
+
+        if( c == ' ' || c == '\t' || c == '\r' || c == '\n' ) {
+            c = skipSpace( svg );
+        }
+        if( c != '=' ) {
+            // An attribute without a value
+            continue;
+        }
+        int quote = skipSpace( svg );
+        if( quote != '"' && quote != '\'' ) {
+            svg->error = "Expected a quoted attribute value";
+            return;
+        }
+
+        // Geometry is streamed, everything else is kept to be looked at
+        if( (element == PATH && strcmp( attribute, "d" ) == 0)
+            || (element == POLYGON && strcmp( attribute, "points" ) == 0) ) {
+            readData( svg, quote, &data, element == POLYGON );
+            c = next( svg );
+            continue;
+        }
+
+        char value[SVG_VALUE + 1];
+        readValue( svg, quote, value );
+        c = next( svg );
+
+        if( strcmp( attribute, "fill" ) == 0 ) {
+            filled = strcmp( value, "none" ) != 0;
+        } else if( strcmp( attribute, "style" ) == 0 ) {
+            // Only the fill is looked at, with the spaces taken out
+            char* to = value;
+            for( char* from = value; *from != '\0'; from++ ) {
+                if( *from != ' ' ) {
+                    *to++ = *from;
+                }
+            }
+            *to = '\0';
+            char* fill = strstr( value, "fill:" );
+            if( fill != NULL ) {
+                filled = strncmp( fill + 5, "none", 4 ) != 0;
+            }
+        } else if( element == CIRCLE ) {
+            int index = strcmp( attribute, "cx" ) == 0 ? 0 : strcmp( attribute, "cy" ) == 0 ? 1
+                        : strcmp( attribute, "r" ) == 0 ? 2 : -1;
+            if( index >= 0 ) {
+                circle[index] = atof( value );
+            }
+        } else if( element == ROOT && strcmp( attribute, "viewBox" ) == 0 ) {
+            hasViewBox = sscanf( value, "%lf%*[ ,]%lf%*[ ,]%lf%*[ ,]%lf", &viewBox[0], &viewBox[1], &viewBox[2],
+                                 &viewBox[3] ) == 4;
+        } else if( element == ROOT && strcmp( attribute, "height" ) == 0 && !hasViewBox ) {
+            // A percentage can't be resolved without a viewport, so the page
+            // height is kept for it
+            char* unit;
+            double height = strtod( value, &unit );
+            if( unit != value && height > 0 && strchr( unit, '%' ) == NULL ) {
+                svg->flip = height;
+            }
+        }
+    }
+    if( svg->error != NULL ) {
+        return;
+    }
+
+    // The drawing is flipped within the outermost viewport
+    if( element == ROOT ) {
+        if(hasViewBox) {
+            svg->flip = viewBox[1] + viewBox[3];
+        }
+        svg->rooted = true;
+    }
+
+    const SvgSink* sink = svg->sink;
+    if( data.started ) {
+        if( element == POLYGON ) {
+            sink->close( sink->context );
+        }
+        sink->paint( sink->context, filled );
+    } else if( element == CIRCLE && circle[2] > 0 ) {
+        sink->circle( sink->context, circle[0], svg->flip - circle[1], circle[2], filled );
+    }
+}
+
+/*
+ * Reads an attribute value up to its closing quote, keeping as much of it as
+ * fits.
+ *
+ * Input:
+ * int quote   - The quote the value started with.
+ * char* value - Used to return the value.
+ */
+void readValue( Svg* svg, int quote, char* value ) {
+    int length = 0;
+    int c;
+    while( (c = next( svg )) != EOF && c != quote ) {
+        if( length < SVG_VALUE ) {
+            value[length++] = c;
+        }
+    }
+    value[length] = '\0';
+
+    if( c == EOF ) {
+        svg->error = "Unexpected end of file";
+    }
+}
+
+/*
+ * Reads path data, or the points of a polygon, up to its closing quote,
+ * passing each segment to the sink as soon as it is complete.
+ *
+ * Input:
+ * int quote       - The quote the value started with.
+ * PathData* data  - The state of the path.
+ * bool polygon    - Whether the value is the points of a polygon, which are
+ *                   the same as path data that is all lines.
+ */
+void readData( Svg* svg, int quote, PathData* data, bool polygon ) {
+    if(polygon) {
+        data->command = 'M';
+    }
+
+    int c;
+    while( svg->error == NULL && (c = next( svg )) != EOF && c != quote ) {
+        bool flag = (data->command == 'A' || data->command == 'a') && (data->argc == 3 || data->argc == 4);
+        if( c >= '0' && c <= '9' ) {
+            data->number[data->length++] = c;
+            // The flags of an arc are single digits, that may run together
+            if( flag && data->length == 1 ) {
+                addNumber( svg, data, polygon );
+            }
+        } else if( c == '.' && !data->point && !data->exponent ) {
+            data->number[data->length++] = c;
+            data->point = true;
+        } else if( (c == 'e' || c == 'E') && data->length > 0 && !data->exponent ) {
+            data->number[data->length++] = c;
+            data->exponent = true;
+        } else if( (c == '-' || c == '+')
+                   && (data->length == 0 || data->number[data->length - 1] == 'e'
+                       || data->number[data->length - 1] == 'E') ) {
+            data->number[data->length++] = c;
+        } else {
+            // Anything else ends a number, and may start the next one
+            addNumber( svg, data, polygon );
+            if( c == '.' || c == '-' || c == '+' ) {
+                data->number[data->length++] = c;
+                data->point = c == '.';
+            } else if( strchr( "MmLlHhVvCcSsQqTtAaZz", c ) != NULL && !polygon ) {
+                if( data->argc > 0 ) {
+                    svg->error = "Path command is missing numbers";
+                } else if( data->command == 0 && c != 'M' && c != 'm' ) {
+                    svg->error = "Path data must start with a move";
+                }
+                data->command = c;
+                if( c == 'Z' || c == 'z' ) {
+                    runCommand( svg, data );
+                }
+            } else if( c != ' ' && c != ',' && c != '\t' && c != '\r' && c != '\n' ) {
+                svg->error = "Invalid character in path data";
+            }
+        }
+
+        if( data->length >= SVG_NUMBER - 1 ) {
+            svg->error = "Number in path data is too long";
+        }
+    }
+
+    if( svg->error == NULL ) {
+        addNumber( svg, data, polygon );
+        if( c == EOF ) {
+            svg->error = "Unexpected end of file";
+        } else if( data->argc > 0 ) {
+            svg->error = polygon ? "Invalid polygon points" : "Path command is missing numbers";
+        }
+    }
+}
+
+/*
+ * Ends the number being read, if there is one, and runs the command once it
+ * has all of its numbers.
+ */
+void addNumber( Svg* svg, PathData* data, bool polygon ) {
+    if( data->length == 0 ) {
+        return;
+    }
+    data->number[data->length] = '\0';
+    data->length = 0;
+    data->point = false;
+    data->exponent = false;
+
+    char* end;
+    double value = strtod( data->number, &end );
+    if( *end != '\0' ) {
+        svg->error = "Invalid number in path data";
+        return;
+    }
+    if( data->command == 0 || data->command == 'Z' || data->command == 'z' ) {
+        svg->error = polygon ? "Invalid polygon points" : "Path data must start with a move";
+        return;
+    }
+
+    data->args[data->argc++] = value;
+    if( data->argc == arity( data->command ) ) {
+        runCommand( svg, data );
+        data->argc = 0;
+    }
+}
+
+/*
+ * Runs a path command with its numbers, converting it to absolute lines and
+ * cubic curves.
+ */
+void runCommand( Svg* svg, PathData* data ) {
+    char command = data->command;
+    double* a = data->args;
+    bool relative = command >= 'a' && command <= 'z';
+    double dx = relative ? data->x : 0;
+    double dy = relative ? data->y : 0;
+
+    // Curves reflect the last control point of the curve before them, if it
+    // was of the same kind
+    char previous = data->previous;
+    bool cubic = strchr( "CcSs", previous ) != NULL;
+    bool quadratic = strchr( "QqTt", previous ) != NULL;
+    double reflectX = 2 * data->x - data->controlX;
+    double reflectY = 2 * data->y - data->controlY;
+    double x0 = data->x, y0 = data->y;
+
+    switch( command ) {
+        case 'M':
+        case 'm':
+            moveTo( svg, data, a[0] + dx, a[1] + dy );
+            // Further pairs are lines
+            data->command = relative ? 'l' : 'L';
+            break;
+        case 'L':
+        case 'l':
+            lineTo( svg, data, a[0] + dx, a[1] + dy );
+            break;
+        case 'H':
+        case 'h':
+            lineTo( svg, data, a[0] + dx, data->y );
+            break;
+        case 'V':
+        case 'v':
+            lineTo( svg, data, data->x, a[0] + dy );
+            break;
+        case 'C':
+        case 'c':
+            curveTo( svg, data, a[0] + dx, a[1] + dy, a[2] + dx, a[3] + dy, a[4] + dx, a[5] + dy );
+            break;
+        case 'S':
+        case 's':
+            curveTo( svg, data, cubic ? reflectX : x0, cubic ? reflectY : y0, a[0] + dx, a[1] + dy, a[2] + dx,
+                     a[3] + dy );
+            break;
+        case 'Q':
+        case 'q':
+        case 'T':
+        case 't': {
+            // A quadratic curve is a cubic curve with its control points two
+            // thirds of the way to the quadratic one
+            bool smooth = command == 'T' || command == 't';
+            double qx = smooth ? (quadratic ? reflectX : x0) : a[0] + dx;
+            double qy = smooth ? (quadratic ? reflectY : y0) : a[1] + dy;
+            double x = (smooth ? a[0] : a[2]) + dx;
+            double y = (smooth ? a[1] : a[3]) + dy;
+            curveTo( svg, data, x0 + 2 * (qx - x0) / 3, y0 + 2 * (qy - y0) / 3, x + 2 * (qx - x) / 3,
+                     y + 2 * (qy - y) / 3, x, y );
+            data->controlX = qx;
+            data->controlY = qy;
+            break;
+        }
+        case 'A':
+        case 'a':
+            addArc( svg, data, a[0], a[1], a[2], a[3] != 0, a[4] != 0, a[5] + dx, a[6] + dy );
+            break;
+        case 'Z':
+        case 'z':
+            if( data->started ) {
+                svg->sink->close( svg->sink->context );
+            }
+            data->x = data->startX;
+            data->y = data->startY;
+            break;
+    }
+
+    data->previous = command;
+}
+
+/*
+ * Adds an elliptical arc as cubic curves, of at most a quarter turn each,
+ * following the conversion from endpoints to a center in the SVG
+ * specification.
+ */
+void addArc( Svg* svg, PathData* data, double rx, double ry, double angle, bool large, bool sweep,
+             double x, double y ) {
+    double x1 = data->x, y1 = data->y;
+    if( x1 == x && y1 == y ) {
+        return;
+    }
+    rx = fabs(rx);
+    ry = fabs(ry);
+    if( rx == 0 || ry == 0 ) {
+        lineTo( svg, data, x, y );
+        return;
+    }
+
+    double c = cos( angle * M_PI / 180 );
+    double s = sin( angle * M_PI / 180 );
+    double mx = (x1 - x) / 2, my = (y1 - y) / 2;
+    double px = c * mx + s * my;
+    double py = -s * mx + c * my;
+
+    // Radii too small to reach the end are scaled up
+    double scale = px * px / (rx * rx) + py * py / (ry * ry);
+    if( scale > 1 ) {
+        rx *= sqrt(scale);
+        ry *= sqrt(scale);
+    }
+
+    double numerator = rx * rx * ry * ry - rx * rx * py * py - ry * ry * px * px;
+    double denominator = rx * rx * py * py + ry * ry * px * px;
+    double coefficient = sqrt( fmax( 0, numerator / denominator ) );
+    if( large == sweep ) {
+        coefficient = -coefficient;
+    }
+    double cpx = coefficient * rx * py / ry;
+    double cpy = -coefficient * ry * px / rx;
+    double cx = c * cpx - s * cpy + (x1 + x) / 2;
+    double cy = s * cpx + c * cpy + (y1 + y) / 2;
+
+    double ux = (px - cpx) / rx, uy = (py - cpy) / ry;
+    double vx = (-px - cpx) / rx, vy = (-py - cpy) / ry;
+    double start = atan2( uy, ux );
+    double sweepAngle = atan2( ux * vy - uy * vx, ux * vx + uy * vy );
+    if( !sweep && sweepAngle > 0 ) {
+        sweepAngle -= 2 * M_PI;
+    } else if( sweep && sweepAngle < 0 ) {
+        sweepAngle += 2 * M_PI;
+    }
+
+    int segments = (int)ceil( fabs(sweepAngle) / (M_PI / 2) - 1e-9 );
+    double step = sweepAngle / segments;
+    double k = 4.0 / 3 * tan( step / 4 );
+    for( int i = 0; i < segments; i++ ) {
+        double t1 = start + i * step;
+        double t2 = t1 + step;
+        double unit[6] = { cos(t1) - k * sin(t1), sin(t1) + k * cos(t1),
+                           cos(t2) + k * sin(t2), sin(t2) - k * cos(t2),
+                           cos(t2), sin(t2) };
+        double points[6];
+        for( int j = 0; j < 6; j += 2 ) {
+            points[j] = cx + rx * c * unit[j] - ry * s * unit[j + 1];
+            points[j + 1] = cy + rx * s * unit[j] + ry * c * unit[j + 1];
+        }
+        // End exactly where the arc was asked to
+        if( i == segments - 1 ) {
+            points[4] = x;
+            points[5] = y;
+        }
+        curveTo( svg, data, points[0], points[1], points[2], points[3], points[4], points[5] );
+    }
+}
+
+/*
+ * Starts a subpath.
+ */
+void moveTo( Svg* svg, PathData* data, double x, double y ) {
+    const SvgSink* sink = svg->sink;
+    if( !data->started ) {
+        sink->begin( sink->context );
+        data->started = true;
+    }
+    sink->moveTo( sink->context, x, svg->flip - y );
+    data->x = data->startX = data->controlX = x;
+    data->y = data->startY = data->controlY = y;
+}
+
+/*
+ * Adds a line to the current subpath.
+ */
+void lineTo( Svg* svg, PathData* data, double x, double y ) {
+    svg->sink->lineTo( svg->sink->context, x, svg->flip - y );
+    data->x = data->controlX = x;
+    data->y = data->controlY = y;
+}
+
+/*
+ * Adds a cubic curve to the current subpath.
+ */
+void curveTo( Svg* svg, PathData* data, double x1, double y1, double x2, double y2, double x, double y ) {
+    double points[6] = { x1, svg->flip - y1, x2, svg->flip - y2, x, svg->flip - y };
+    svg->sink->curveTo( svg->sink->context, points );
+    data->x = x;
+    data->y = y;
+    data->controlX = x2;
+    data->controlY = y2;
+}
+
+/*
+ * Gets the number of numbers a path command takes.
+ */
+int arity( char command ) {
+    switch( command ) {
+        case 'H': case 'h': case 'V': case 'v':
+            return 1;
+        case 'M': case 'm': case 'L': case 'l': case 'T': case 't':
+            return 2;
+        case 'S': case 's': case 'Q': case 'q':
+            return 4;
+        case 'C': case 'c':
+            return 6;
+        case 'A': case 'a':
+            return 7;
+        default:
+            return 0;
+    }
+}
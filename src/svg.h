@@ -0,0 +1,34 @@
+/* PostGen SVG
+ *
+ * Provides streaming import of the paths, circles and polygons of an SVG
+ * file.
+ */
+
+#ifndef SVG_H
+#define SVG_H
+
+#include <stdbool.h>
+
+// Receives the shapes of an SVG file as they are read. Coordinates are in
+// the user space of the file, flipped so that y points up, with the bottom
+// of the drawing at 0.
+typedef struct SvgSink {
+    void* context;
+    // Starts the path of a shape, before its first segment
+    void (*begin)( void* context );
+    void (*moveTo)( void* context, double x, double y );
+    void (*lineTo)( void* context, double x, double y );
+    // Adds a cubic curve, given its two control points and its end
+    void (*curveTo)( void* context, const double points[6] );
+    void (*close)( void* context );
+    // Paints the path, filled or stroked
+    void (*paint)( void* context, bool filled );
+    void (*circle)( void* context, double x, double y, double r, bool filled );
+} SvgSink;
+
+// Public function prototypes:
+
+// Reads the shapes of an SVG file, passing each to the sink as it is read
+const char* svgImport( const char* filename, const SvgSink* sink, int* line );
+
+#endif
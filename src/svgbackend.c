@@ -0,0 +1,317 @@
+/* PostGen SVG Backend
+ *
+ * Writes sessions as SVG, so that a script can be previewed in a browser
+ * without converting its PostScript.
+ *
+ * The page is a US Letter page, like PostScript's default, drawn within a
+ * group that flips the y axis so that coordinates are the same as in
+ * PostScript. Each path is written as a path element, with the style it is
+ * painted with as its attributes. Rotations open a group that is closed by the
+ * restore that ends them. SVG has no loops, so every iteration of a loop is
+ * written out.
+ *
+ * The state of the path being written is per thread, as shapes may be
+ * generated on worker threads.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "backend.h"
+#include "gstate.h"
+#include "number.h"
+
+// The size of the page, in points
+#define PAGE_WIDTH 612
+#define PAGE_HEIGHT 792
+
+// Private function prototypes:
+
+static void begin( Writer* out );
+static void end( Writer* out );
+static void save( Writer* out );
+static void restore( Writer* out );
+static void rotate( Writer* out, Arg degrees );
+static void newPath( Writer* out );
+static void moveTo( Writer* out, Arg x, Arg y );
+static void lineTo( Writer* out, Arg x, Arg y );
+static void curveTo( Writer* out, const Arg points[6] );
+static void arc( Writer* out, Arg x, Arg y, Arg r );
+static void closePath( Writer* out );
+static void sync( Writer* out, unsigned parts );
+static void paint( Writer* out, bool solid );
+// Helpers for writing path data
+static void startSegment( Writer* out, char command );
+static void discardPath( Writer* out );
+static void writePoint( Writer* out, double x, double y );
+static void writeNumber( Writer* out, double value );
+static void writeColor( Writer* out, const double color[3] );
+
+const Backend svgBackend =
+        {
+            .name = "svg",
+            .extension = ".svg",
+            .features = 0,
+            .begin = begin,
+            .end = end,
+            .save = save,
+            .restore = restore,
+            .rotate = rotate,
+            .newPath = newPath,
+            .moveTo = moveTo,
+            .lineTo = lineTo,
+            .curveTo = curveTo,
+            .arc = arc,
+            .closePath = closePath,
+            .sync = sync,
+            .paint = paint,
+            .repeat = NULL,
+            .endRepeat = NULL
+        };
+
+// Whether a path element has been started, and its data not yet finished
+static _Thread_local bool open = false;
+
+// The number of rotation groups opened since each save, the first being
+// those opened outside of any save
+static _Thread_local int groups[MAX_GSTATE_DEPTH];
+static _Thread_local int depth = 0;
+
+// Levels of save nesting beyond what is tracked, whose groups are counted
+// with the deepest tracked level
+static _Thread_local int overflow = 0;
+
+/*
+ * Starts the page, with a group that flips the y axis. Strokes are mitered as
+ * sharply as in PostScript.
+ */
+void begin( Writer* out ) {
+    open = false;
+    groups[0] = 0;
+    depth = 0;
+    overflow = 0;
+
+    writerPrintf( out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" );
+    writerPrintf( out, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\">\n",
+                  PAGE_WIDTH, PAGE_HEIGHT, PAGE_WIDTH, PAGE_HEIGHT );
+    writerPrintf( out, "<g transform=\"matrix(1 0 0 -1 0 %d)\" stroke-miterlimit=\"10\">\n", PAGE_HEIGHT );
+}
+
+/*
+ * Finishes the page, closing any groups that are still open.
+ */
+void end( Writer* out ) {
+    discardPath( out );
+    while( depth > 0 ) {
+        restore( out );
+    }
+    for( ; groups[0] > 0; groups[0]-- ) {
+        writerPrintf( out, "</g>\n" );
+    }
+    writerPrintf( out, "</g>\n</svg>\n" );
+}
+
+/*
+ * Starts counting the groups opened by rotations, so that restore closes them.
+ */
+void save( Writer* out ) {
+    discardPath( out );
+    if( depth + 1 < MAX_GSTATE_DEPTH ) {
+        groups[++depth] = 0;
+    } else {
+        overflow++;
+    }
+}
+
+/*
+ * Closes the groups opened since the last save.
+ */
+void restore( Writer* out ) {
+    discardPath( out );
+    if( overflow > 0 ) {
+        overflow--;
+        return;
+    }
+    for( ; groups[depth] > 0; groups[depth]-- ) {
+        writerPrintf( out, "</g>\n" );
+    }
+    if( depth > 0 ) {
+        depth--;
+    }
+}
+
+/*
+ * Opens a group rotated by the given angle. SVG rotates towards the y axis,
+ * which points up within the page group, so the angle is as in PostScript.
+ */
+void rotate( Writer* out, Arg degrees ) {
+    discardPath( out );
+    writerPrintf( out, "<g transform=\"rotate(" );
+    writeNumber( out, degrees.value );
+    writerPrintf( out, ")\">\n" );
+    groups[depth]++;
+}
+
+/*
+ * Starts a new path, throwing away one that wasn't painted.
+ */
+void newPath( Writer* out ) {
+    discardPath( out );
+}
+
+/*
+ * Starts a subpath at a point.
+ */
+void moveTo( Writer* out, Arg x, Arg y ) {
+    startSegment( out, 'M' );
+    writePoint( out, x.value, y.value );
+}
+
+/*
+ * Adds a line to a point.
+ */
+void lineTo( Writer* out, Arg x, Arg y ) {
+    startSegment( out, 'L' );
+    writePoint( out, x.value, y.value );
+}
+
+/*
+ * Adds a cubic curve.
+ */
+void curveTo( Writer* out, const Arg points[6] ) {
+    startSegment( out, 'C' );
+    for( int i = 0; i < 6; i += 2 ) {
+        if( i > 0 ) {
+            writerPrintf( out, " " );
+        }
+        writePoint( out, points[i].value, points[i + 1].value );
+    }
+}
+
+/*
+ * Adds a full circle as two half circles, counterclockwise like PostScript's
+ * arc. As in PostScript, a line is drawn to the circle from the current point
+ * if there is one.
+ */
+void arc( Writer* out, Arg x, Arg y, Arg r ) {
+    double radius = fabs( r.value );
+    startSegment( out, open ? 'L' : 'M' );
+    writePoint( out, x.value + radius, y.value );
+    for( int i = 0; i < 2; i++ ) {
+        writerPrintf( out, " A" );
+        writeNumber( out, radius );
+        writerPrintf( out, " " );
+        writeNumber( out, radius );
+        writerPrintf( out, " 0 1 1 " );
+        writePoint( out, x.value + (i == 0 ? -radius : radius), y.value );
+    }
+}
+
+/*
+ * Closes the current subpath.
+ */
+void closePath( Writer* out ) {
+    if(open) {
+        writerPrintf( out, " Z" );
+    }
+}
+
+/*
+ * Does nothing, as the style is written with each path.
+ */
+void sync( Writer* out, unsigned parts ) {
+    (void)out;
+    (void)parts;
+}
+
+/*
+ * Finishes the current path element, filled or stroked with the requested
+ * style. A line width of 0 is PostScript's thinnest line, which is drawn as
+ * a line that stays one pixel wide at any scale.
+ */
+void paint( Writer* out, bool solid ) {
+    if(!open) {
+        return;
+    }
+
+    const GState* style = gstatePending();
+    if(solid) {
+        writerPrintf( out, "\" fill=\"" );
+        writeColor( out, style->color );
+    } else {
+        writerPrintf( out, "\" fill=\"none\" stroke=\"" );
+        writeColor( out, style->color );
+        if( style->lineWidth > 0 ) {
+            writerPrintf( out, "\" stroke-width=\"" );
+            writeNumber( out, style->lineWidth );
+        } else {
+            writerPrintf( out, "\" stroke-width=\"1\" vector-effect=\"non-scaling-stroke" );
+        }
+        if( style->dashCount > 0 ) {
+            writerPrintf( out, "\" stroke-dasharray=\"" );
+            for( int i = 0; i < style->dashCount; i++ ) {
+                if( i > 0 ) {
+                    writerPrintf( out, " " );
+                }
+                writeNumber( out, style->dash[i] );
+            }
+        }
+    }
+    writerPrintf( out, "\"/>\n" );
+    open = false;
+}
+
+/*
+ * Starts a segment of the path data, starting the path element first if
+ * needed.
+ *
+ * Input:
+ * Writer* out  - The session.
+ * char command - The SVG path command of the segment.
+ */
+void startSegment( Writer* out, char command ) {
+    if(!open) {
+        writerPrintf( out, "<path d=\"%c", command );
+        open = true;
+    } else {
+        writerPrintf( out, " %c", command );
+    }
+}
+
+/*
+ * Finishes a path element that was never painted, so that it draws nothing,
+ * as the path is thrown away in PostScript.
+ */
+void discardPath( Writer* out ) {
+    if(open) {
+        writerPrintf( out, "\" fill=\"none\"/>\n" );
+        open = false;
+    }
+}
+
+/*
+ * Writes a point of the path data.
+ */
+void writePoint( Writer* out, double x, double y ) {
+    writeNumber( out, x );
+    writerPrintf( out, " " );
+    writeNumber( out, y );
+}
+
+/*
+ * Writes a number with the current precision.
+ */
+void writeNumber( Writer* out, double value ) {
+    char buf[NUMBER_BUF_SIZE];
+    int length = formatNumber( buf, value );
+    writerWrite( out, buf, length );
+}
+
+/*
+ * Writes a color as a hex triplet.
+ */
+void writeColor( Writer* out, const double color[3] ) {
+    writerPrintf( out, "#%02x%02x%02x", (int)lround( color[0] * 255 ), (int)lround( color[1] * 255 ),
+                  (int)lround( color[2] * 255 ) );
+}
@@ -0,0 +1,584 @@
+/* PostGen Writer
+ *
+ * Sessions are written through a Writer rather than stdio so that a slow
+ * destination, such as a network filesystem, doesn't stall the interpreter.
+ *
+ * A synchronous writer simply buffers output and writes each full buffer.
+ *
+ * An asynchronous writer double-buffers output: once a buffer fills up it is
+ * handed off to be written while the interpreter continues filling the other.
+ * The hand off uses io_uring when PostGen is built with liburing (make
+ * URING=1) and the kernel supports it, and otherwise a background writer
+ * thread. Either way, at most one buffer is being written at a time, so
+ * output is written in order, and the interpreter only blocks if it fills a
+ * buffer before the previous one has been written.
+ *
+ * A memory writer has no destination, and instead grows its buffer to hold
+ * everything written until it is taken, so output can be examined before it
+ * is written out.
+ *
+ * Write errors are sticky: the first one is kept and reported when the writer
+ * is flushed or closed.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "writer.h"
+
+struct Writer {
+    // The destination of the output
+    int fd;
+    // Whether buffers are written in the background
+    bool async;
+    // Whether output is kept in memory rather than written
+    bool memory;
+
+    // The buffers output is collected in, and the one being filled
+    char* buffers[2];
+    int active;
+    size_t used;
+    size_t capacity;
+
+    // The first error encountered while writing
+    int error;
+
+    // Background thread state, guarded by lock
+    bool threaded;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    const char* pending;
+    size_t pendingLength;
+    bool busy;
+    bool stop;
+
+#ifdef HAVE_LIBURING
+    // io_uring state
+    bool ringed;
+    struct io_uring ring;
+    const char* inFlight;
+    size_t inFlightLength;
+    size_t inFlightDone;
+#endif
+};
+
+// Private function prototypes:
+
+static int writeAll( int fd, const char* data, size_t length );
+static void* writerThread( void* arg );
+static void submit( Writer* writer, const char* data, size_t length );
+static void waitPending( Writer* writer );
+static bool grow( Writer* writer, size_t length );
+
+#ifdef HAVE_LIBURING
+static void ringSubmit( Writer* writer );
+#endif
+
+/*
+ * Creates a writer for an open file descriptor. The writer takes ownership of
+ * the descriptor, and closes it when the writer is closed.
+ *
+ * Input:
+ * int fd     - The file descriptor to write to.
+ * bool async - Whether full buffers should be written in the background.
+ *
+ * Returns:
+ * The writer, or NULL if it could not be created.
+ */
+Writer* writerOpen( int fd, bool async ) {
+    Writer* writer = (Writer*)calloc( 1, sizeof(Writer) );
+    if( writer == NULL ) {
+        return NULL;
+    }
+
+    writer->fd = fd;
+    writer->async = async;
+    writer->capacity = WRITER_BUF_SIZE;
+
+    // Only an asynchronous writer needs a second buffer
+    writer->buffers[0] = (char*)malloc(WRITER_BUF_SIZE);
+    writer->buffers[1] = async ? (char*)malloc(WRITER_BUF_SIZE) : NULL;
+    if( writer->buffers[0] == NULL || (async && writer->buffers[1] == NULL) ) {
+        free( writer->buffers[0] );
+        free( writer->buffers[1] );
+        free(writer);
+        return NULL;
+    }
+
+    if(async) {
+#ifdef HAVE_LIBURING
+        // Writes must be able to use the current file position, so that
+        // pipes and files opened for appending work too
+        if( io_uring_queue_init( 4, &writer->ring, 0 ) == 0 ) {
+            if( writer->ring.features & IORING_FEAT_RW_CUR_POS ) {
+                writer->ringed = true;
+            } else {
+                io_uring_queue_exit( &writer->ring );
+            }
+        }
+        if( !writer->ringed )
+#endif
+        {
+            // Fall back to a background writer thread
+            pthread_mutex_init( &writer->lock, NULL );
+            pthread_cond_init( &writer->cond, NULL );
+            if( pthread_create( &writer->thread, NULL, writerThread, writer ) == 0 ) {
+                writer->threaded = true;
+            } else {
+                // Without a thread, write synchronously instead
+                pthread_mutex_destroy( &writer->lock );
+                pthread_cond_destroy( &writer->cond );
+                writer->async = false;
+            }
+        }
+    }
+
+    return writer;
+}
+
+/*
+ * Creates a writer that keeps its output in memory until it is taken.
+ *
+ * Returns:
+ * The writer, or NULL if it could not be created.
+ */
+Writer* writerOpenMemory( void ) {
+    Writer* writer = (Writer*)calloc( 1, sizeof(Writer) );
+    if( writer == NULL ) {
+        return NULL;
+    }
+
+    writer->fd = -1;
+    writer->memory = true;
+    writer->capacity = WRITER_BUF_SIZE;
+    writer->buffers[0] = (char*)malloc(WRITER_BUF_SIZE);
+    if( writer->buffers[0] == NULL ) {
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+/*
+ * Takes the output collected by a memory writer so far, leaving it empty.
+ *
+ * Input:
+ * Writer* writer - The memory writer.
+ * size_t* length - Used to return the length of the output.
+ *
+ * Returns:
+ * A copy of the output, to be freed by the caller, or NULL if it could not be
+ * allocated. The copy is not null-terminated.
+ */
+char* writerTake( Writer* writer, size_t* length ) {
+    char* data = (char*)malloc( writer->used > 0 ? writer->used : 1 );
+    if( data == NULL ) {
+        if( writer->error == 0 ) {
+            writer->error = ENOMEM;
+        }
+        *length = 0;
+        return NULL;
+    }
+
+    memcpy( data, writer->buffers[0], writer->used );
+    *length = writer->used;
+    writer->used = 0;
+
+    return data;
+}
+
+/*
+ * Appends data to the writer.
+ *
+ * Input:
+ * Writer* writer   - The writer.
+ * const char* data - The data to write.
+ * size_t length    - The length of the data.
+ */
+void writerWrite( Writer* writer, const char* data, size_t length ) {
+    // A memory writer makes room by growing instead
+    if( writer->memory && writer->used + length > writer->capacity ) {
+        if( !grow( writer, writer->used + length ) ) {
+            return;
+        }
+    }
+
+    // Make room for the data if it doesn't fit
+    if( writer->used + length > writer->capacity ) {
+        writerFlush(writer);
+
+        // Data larger than a buffer is written directly, in order
+        if( length > WRITER_BUF_SIZE ) {
+            waitPending(writer);
+            int err = writeAll( writer->fd, data, length );
+            if( err != 0 && writer->error == 0 ) {
+                writer->error = err;
+            }
+            return;
+        }
+    }
+
+    memcpy( writer->buffers[writer->active] + writer->used, data, length );
+    writer->used += length;
+}
+
+/*
+ * Appends formatted data to the writer, as with printf.
+ *
+ * Input:
+ * Writer* writer     - The writer.
+ * const char* format - The printf format string.
+ * ...                - The values to format.
+ */
+void writerPrintf( Writer* writer, const char* format, ... ) {
+    va_list args;
+    va_list retry;
+
+    // Try formatting straight into the buffer
+    va_start( args, format );
+    va_copy( retry, args );
+    size_t room = writer->capacity - writer->used;
+    int length = vsnprintf( writer->buffers[writer->active] + writer->used, room, format, args );
+    va_end(args);
+
+    if( length < 0 ) {
+        va_end(retry);
+        return;
+    }
+
+    if( (size_t)length < room ) {
+        writer->used += length;
+    } else if( writer->memory ) {
+        // Grow to fit, and format it again
+        if( grow( writer, writer->used + length + 1 ) ) {
+            vsnprintf( writer->buffers[0] + writer->used, length + 1, format, retry );
+            writer->used += length;
+        }
+    } else if( length < WRITER_BUF_SIZE ) {
+        // Didn't fit, so start a new buffer and format it again
+        writerFlush(writer);
+        vsnprintf( writer->buffers[writer->active], WRITER_BUF_SIZE, format, retry );
+        writer->used = length;
+    } else {
+        // Larger than a buffer, which only happens with very long arguments
+        char* formatted = (char*)malloc(length + 1);
+        if( formatted != NULL ) {
+            vsnprintf( formatted, length + 1, format, retry );
+            writerWrite( writer, formatted, length );
+            free(formatted);
+        } else if( writer->error == 0 ) {
+            writer->error = ENOMEM;
+        }
+    }
+    va_end(retry);
+}
+
+/*
+ * Hands all buffered data off to be written. For a synchronous writer the data
+ * has been written when this returns; for an asynchronous one it may still be
+ * in progress.
+ *
+ * Input:
+ * Writer* writer - The writer.
+ *
+ * Returns:
+ * False if any write has failed so far, true otherwise.
+ */
+bool writerFlush( Writer* writer ) {
+    // Memory writers keep everything until it is taken
+    if( writer->used > 0 && !writer->memory ) {
+        submit( writer, writer->buffers[writer->active], writer->used );
+        writer->used = 0;
+
+        // Fill the other buffer while this one is written
+        if( writer->async ) {
+            writer->active = !writer->active;
+        }
+    }
+
+    return writerError(writer) == 0;
+}
+
+/*
+ * Writes all remaining data, waits for it to complete, then closes the writer
+ * and its file descriptor.
+ *
+ * Input:
+ * Writer* writer - The writer. It is freed, regardless of the result.
+ *
+ * Returns:
+ * False if any write, or closing the descriptor, failed. The cause is left in
+ * errno.
+ */
+bool writerClose( Writer* writer ) {
+    writerFlush(writer);
+    waitPending(writer);
+
+    // Shut down the background writer
+    if( writer->threaded ) {
+        pthread_mutex_lock( &writer->lock );
+        writer->stop = true;
+        pthread_cond_broadcast( &writer->cond );
+        pthread_mutex_unlock( &writer->lock );
+        pthread_join( writer->thread, NULL );
+        pthread_mutex_destroy( &writer->lock );
+        pthread_cond_destroy( &writer->cond );
+    }
+#ifdef HAVE_LIBURING
+    if( writer->ringed ) {
+        io_uring_queue_exit( &writer->ring );
+    }
+#endif
+
+    int err = writer->error;
+    if( !writer->memory && close( writer->fd ) != 0 && err == 0 ) {
+        err = errno;
+    }
+
+    free( writer->buffers[0] );
+    free( writer->buffers[1] );
+    free(writer);
+
+    errno = err;
+    return err == 0;
+}
+
+/*
+ * Gets the first error encountered while writing.
+ *
+ * Input:
+ * Writer* writer - The writer.
+ *
+ * Returns:
+ * The errno value of the first failed write, or 0 if none have failed.
+ */
+int writerError( Writer* writer ) {
+    int err;
+    if( writer->threaded ) {
+        pthread_mutex_lock( &writer->lock );
+        err = writer->error;
+        pthread_mutex_unlock( &writer->lock );
+    } else {
+        err = writer->error;
+    }
+
+    return err;
+}
+
+/*
+ * Grows the buffer of a memory writer.
+ *
+ * Input:
+ * Writer* writer - The memory writer.
+ * size_t length  - The total length the buffer must hold.
+ *
+ * Returns:
+ * True if the buffer now holds the given length, false if it couldn't grow.
+ */
+bool grow( Writer* writer, size_t length ) {
+    size_t capacity = writer->capacity;
+    while( capacity < length ) {
+        capacity *= 2;
+    }
+
+    char* buffer = (char*)realloc( writer->buffers[0], capacity );
+    if( buffer == NULL ) {
+        if( writer->error == 0 ) {
+            writer->error = ENOMEM;
+        }
+        return false;
+    }
+
+    writer->buffers[0] = buffer;
+    writer->capacity = capacity;
+    return true;
+}
+
+/*
+ * Writes all of the given data, retrying after partial writes and signals.
+ *
+ * Input:
+ * int fd           - The file descriptor to write to.
+ * const char* data - The data to write.
+ * size_t length    - The length of the data.
+ *
+ * Returns:
+ * 0 on success, or the errno value of the failed write.
+ */
+int writeAll( int fd, const char* data, size_t length ) {
+    while( length > 0 ) {
+        ssize_t written = write( fd, data, length );
+        if( written < 0 ) {
+            if( errno == EINTR ) {
+                continue;
+            }
+            return errno;
+        }
+        data += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+/*
+ * Main loop of the background writer thread. Writes each buffer handed to it
+ * until told to stop.
+ *
+ * Input:
+ * void* arg - The writer.
+ */
+void* writerThread( void* arg ) {
+    Writer* writer = (Writer*)arg;
+
+    pthread_mutex_lock( &writer->lock );
+    while(1) {
+        // Wait for a buffer, or to be stopped
+        while( !writer->busy && !writer->stop ) {
+            pthread_cond_wait( &writer->cond, &writer->lock );
+        }
+        if( !writer->busy ) {
+            break;
+        }
+
+        // Write without holding the lock, so the interpreter can continue
+        const char* data = writer->pending;
+        size_t length = writer->pendingLength;
+        pthread_mutex_unlock( &writer->lock );
+        int err = writeAll( writer->fd, data, length );
+        pthread_mutex_lock( &writer->lock );
+
+        if( err != 0 && writer->error == 0 ) {
+            writer->error = err;
+        }
+        writer->busy = false;
+        pthread_cond_broadcast( &writer->cond );
+    }
+    pthread_mutex_unlock( &writer->lock );
+
+    return NULL;
+}
+
+/*
+ * Writes a full buffer, either directly or by handing it off once the
+ * previous buffer has finished.
+ *
+ * Input:
+ * Writer* writer   - The writer.
+ * const char* data - The buffer to write. Must not be modified until written.
+ * size_t length    - The length of the data.
+ */
+void submit( Writer* writer, const char* data, size_t length ) {
+    // Only one buffer may be in progress at a time
+    waitPending(writer);
+
+    // Nothing more is written after an error
+    if( writer->error != 0 ) {
+        return;
+    }
+
+#ifdef HAVE_LIBURING
+    if( writer->ringed ) {
+        writer->inFlight = data;
+        writer->inFlightLength = length;
+        writer->inFlightDone = 0;
+        ringSubmit(writer);
+        return;
+    }
+#endif
+
+    if( writer->threaded ) {
+        pthread_mutex_lock( &writer->lock );
+        writer->pending = data;
+        writer->pendingLength = length;
+        writer->busy = true;
+        pthread_cond_broadcast( &writer->cond );
+        pthread_mutex_unlock( &writer->lock );
+    } else {
+        writer->error = writeAll( writer->fd, data, length );
+    }
+}
+
+/*
+ * Waits for the buffer being written in the background, if any, to finish.
+ *
+ * Input:
+ * Writer* writer - The writer.
+ */
+void waitPending( Writer* writer ) {
+#ifdef HAVE_LIBURING
+    if( writer->ringed ) {
+        while( writer->inFlight != NULL ) {
+            struct io_uring_cqe* cqe;
+            int err = io_uring_wait_cqe( &writer->ring, &cqe );
+            if( err == -EINTR ) {
+                continue;
+            }
+
+            int result = (err < 0) ? err : cqe->res;
+            if( err == 0 ) {
+                io_uring_cqe_seen( &writer->ring, cqe );
+            }
+
+            if( result == -EINTR || result == -EAGAIN ) {
+                // Try the same write again
+                ringSubmit(writer);
+            } else if( result < 0 ) {
+                writer->error = -result;
+                writer->inFlight = NULL;
+            } else {
+                // Continue after a partial write
+                writer->inFlightDone += result;
+                if( writer->inFlightDone < writer->inFlightLength ) {
+                    ringSubmit(writer);
+                } else {
+                    writer->inFlight = NULL;
+                }
+            }
+        }
+        return;
+    }
+#endif
+
+    if( writer->threaded ) {
+        pthread_mutex_lock( &writer->lock );
+        while( writer->busy ) {
+            pthread_cond_wait( &writer->cond, &writer->lock );
+        }
+        pthread_mutex_unlock( &writer->lock );
+    }
+}
+
+#ifdef HAVE_LIBURING
+/*
+ * Queues a write of the unwritten part of the in flight buffer.
+ *
+ * Input:
+ * Writer* writer - The writer.
+ */
+void ringSubmit( Writer* writer ) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe( &writer->ring );
+    io_uring_prep_write( sqe, writer->fd,
+                         writer->inFlight + writer->inFlightDone,
+                         writer->inFlightLength - writer->inFlightDone,
+                         (unsigned long long)-1 );
+
+    int err = io_uring_submit( &writer->ring );
+    if( err < 0 ) {
+        writer->error = -err;
+        writer->inFlight = NULL;
+    }
+}
+#endif
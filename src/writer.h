@@ -0,0 +1,46 @@
+/* PostGen Writer
+ *
+ * Provides buffered output of sessions to a file descriptor, optionally
+ * written in the background while the interpreter continues, or to memory.
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The size of each output buffer
+#define WRITER_BUF_SIZE (64 * 1024)
+
+// A buffered output stream
+typedef struct Writer Writer;
+
+// Public function prototypes:
+
+// Creates a writer for an open file descriptor
+Writer* writerOpen( int fd, bool async );
+
+// Creates a writer that keeps its output in memory
+Writer* writerOpenMemory( void );
+
+// Takes the output collected by a memory writer
+char* writerTake( Writer* writer, size_t* length );
+
+// Appends data to the writer
+void writerWrite( Writer* writer, const char* data, size_t length );
+
+// Appends formatted data to the writer
+void writerPrintf( Writer* writer, const char* format, ... )
+        __attribute__((format(printf, 2, 3)));
+
+// Hands all buffered data off to be written
+bool writerFlush( Writer* writer );
+
+// Waits for all data to be written, then closes the writer and its descriptor
+bool writerClose( Writer* writer );
+
+// Gets the error that caused the writer to fail, if any
+int writerError( Writer* writer );
+
+#endif